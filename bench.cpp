@@ -0,0 +1,224 @@
+/* 排行基准测试，不经过lua，直接测试lir
+ * ./lir_bench [max_size [ops]]
+ * 测试不同排行大小、底层结构、更新方式下每个操作的耗时，输出每秒操作数
+ * 及耗时分位数(微秒)
+ */
+
+#include "linsertion_ranking.hpp"
+
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+
+#define BENCH_FILE "lir_bench.lir"
+
+typedef enum
+{
+    UP_NUDGE   = 0, // 排序因子小幅变化，移动距离很短
+    UP_UNIFORM = 1, // 随机的排序因子，平均移动n/3
+    UP_TAIL    = 2, // 最后一名变为第一名，移动整个排行
+    UP_DELETE  = 3, // 随机删除一个元素再插入
+    UP_MAX
+}update_t;
+
+static const char *update_name[] = { "nudge","uniform","tail2head","delete" };
+static const char *backend_name[] = { "array","tree" };
+
+/* 纳秒 */
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC,&ts );
+
+    return (int64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+/* 简单的随机数，不同平台结果一致 */
+static uint32_t next_rand( uint64_t &seed )
+{
+    seed = seed*6364136223846793005ULL + 1442695040888963407ULL;
+
+    return (uint32_t)( seed >> 33 );
+}
+
+static void report( const char *backend,int size,const char *name,
+    std::vector<int64_t> &cost )
+{
+    if ( cost.empty() ) return;
+
+    int64_t total = 0;
+    for ( size_t i = 0;i < cost.size();i ++ ) total += cost[i];
+
+    std::sort( cost.begin(),cost.end() );
+    size_t n = cost.size();
+
+    printf( "%-6s %8d %-10s %8d %12.0f %9.2f %9.2f %9.2f %9.2f\n",
+        backend,size,name,(int)n,
+        total > 0 ? n*1e9/total : 0.0,
+        cost[n*50/100]/1e3,cost[n*99/100]/1e3,
+        cost[std::min( n - 1,n*999/1000 )]/1e3,cost[n - 1]/1e3 );
+}
+
+/* 用批量更新填充排行，避免大排行逐个插入太慢 */
+static void fill( lir &rank,int size,uint64_t &seed )
+{
+    std::vector<lir::update_t> updates( size );
+    for ( int i = 0;i < size;i ++ )
+    {
+        lir::update_t &update = updates[i];
+        memset( &update,0,sizeof(update) );
+        update._key       = i + 1;
+        update._cnt       = 1;
+        update._factor[0] = next_rand( seed ) % 1000000;
+    }
+
+    std::vector<int> new_pos( size );
+    std::vector<int> old_pos( size );
+    rank.update_factors( &updates[0],size,&new_pos[0],&old_pos[0] );
+}
+
+static void bench_update( int backend,int size,int ops,int type )
+{
+    uint64_t seed = 20170101 + size;
+    lir rank( BENCH_FILE,backend );
+    fill( rank,size,seed );
+
+    lir::factor_t top = 1000000;
+    lir::factor_t factor[lir::MAX_FACTOR] = { 0 };
+
+    std::vector<int64_t> cost;
+    cost.reserve( ops );
+    for ( int i = 0;i < ops;i ++ )
+    {
+        int old_pos = 0;
+        lir::key_t key = next_rand( seed ) % size + 1;
+
+        int64_t begin = now_ns();
+        switch ( type )
+        {
+        case UP_NUDGE:
+        {
+            lir::factor_t *old = NULL;
+            rank.get_factor( key,&old );
+            factor[0] = old[0] + next_rand( seed ) % 16;
+            rank.update_factor( key,factor,1,old_pos );
+        }break;
+        case UP_UNIFORM:
+        {
+            factor[0] = next_rand( seed ) % 1000000;
+            rank.update_factor( key,factor,1,old_pos );
+        }break;
+        case UP_TAIL:
+        {
+            key = *rank.get_key( size - 1 );
+            factor[0] = ++top;
+            rank.update_factor( key,factor,1,old_pos );
+        }break;
+        case UP_DELETE:
+        {
+            rank.del( key );
+            factor[0] = next_rand( seed ) % 1000000;
+            rank.update_factor( key,factor,1,old_pos );
+        }break;
+        }
+        cost.push_back( now_ns() - begin );
+    }
+
+    report( backend_name[backend],size,update_name[type],cost );
+}
+
+static void bench_query( int backend,int size,int ops )
+{
+    uint64_t seed = 20170102 + size;
+    lir rank( BENCH_FILE,backend );
+    fill( rank,size,seed );
+
+    std::vector<int64_t> pos_cost;
+    std::vector<int64_t> key_cost;
+    pos_cost.reserve( ops );
+    key_cost.reserve( ops );
+
+    volatile int64_t sum = 0; // 避免被优化掉
+    for ( int i = 0;i < ops;i ++ )
+    {
+        lir::key_t key = next_rand( seed ) % size + 1;
+
+        int64_t begin = now_ns();
+        sum += rank.get_position( key );
+        pos_cost.push_back( now_ns() - begin );
+
+        int index = next_rand( seed ) % size;
+
+        begin = now_ns();
+        sum += *rank.get_key( index );
+        key_cost.push_back( now_ns() - begin );
+    }
+
+    report( backend_name[backend],size,"position",pos_cost );
+    report( backend_name[backend],size,"get_key",key_cost );
+}
+
+static void bench_file( int backend,int size )
+{
+    uint64_t seed = 20170103 + size;
+
+    std::vector<int64_t> save_cost;
+    std::vector<int64_t> load_cost;
+    for ( int i = 0;i < 3;i ++ )
+    {
+        {
+            lir rank( BENCH_FILE,backend );
+            fill( rank,size,seed );
+
+            int64_t begin = now_ns();
+            rank.save( true );
+            save_cost.push_back( now_ns() - begin );
+        }
+
+        lir rank( BENCH_FILE,backend );
+
+        int64_t begin = now_ns();
+        int err = rank.load();
+        load_cost.push_back( now_ns() - begin );
+
+        if ( err || rank.size() != size )
+        {
+            printf( "load error:%d,size %d\n",err,rank.size() );
+        }
+    }
+
+    report( backend_name[backend],size,"save",save_cost );
+    report( backend_name[backend],size,"load",load_cost );
+
+    unlink( BENCH_FILE );
+}
+
+int main( int argc,char *argv[] )
+{
+    int max_size = argc > 1 ? atoi( argv[1] ) : 1000000;
+    int max_ops  = argc > 2 ? atoi( argv[2] ) : 100000;
+
+    printf( "%-6s %8s %-10s %8s %12s %9s %9s %9s %9s\n","bk","size","op",
+        "count","ops/s","p50(us)","p99(us)","p999(us)","max(us)" );
+
+    for ( int size = 1000;size <= max_size;size *= 10 )
+    {
+        // 大排行下数组每次更新都要移动很多元素，减少操作次数
+        int ops = std::max( 1000,std::min( max_ops,50000000/size ) );
+        for ( int backend = lir::BK_ARRAY;backend <= lir::BK_TREE;backend ++ )
+        {
+            for ( int type = 0;type < UP_MAX;type ++ )
+            {
+                bench_update( backend,size,ops,type );
+            }
+            bench_query( backend,size,ops );
+            bench_file( backend,size );
+        }
+    }
+
+    return 0;
+}
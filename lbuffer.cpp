@@ -0,0 +1,140 @@
+#include "lbuffer.hpp"
+
+#include <cstring>
+
+lbuffer::~lbuffer()
+{
+    delete []_buff;
+
+    _buff = NULL;
+    _size = 0;
+    _capacity = 0;
+}
+
+lbuffer::lbuffer( size_t size )
+{
+    _size = 0;
+    _capacity = size > 0 ? size : 1;
+    _buff = new char[_capacity];
+}
+
+void lbuffer::reserve( size_t size )
+{
+    if ( size <= _capacity ) return;
+
+    size_t capacity = _capacity;
+    while ( capacity < size ) capacity *= 2;
+
+    char *buff = new char[capacity];
+    if ( _size > 0 ) memcpy( buff,_buff,_size );
+
+    delete []_buff;
+    _buff = buff;
+    _capacity = capacity;
+}
+
+void lbuffer::append( const void *data,size_t sz )
+{
+    reserve( _size + sz );
+
+    memcpy( _buff + _size,data,sz );
+    _size += sz;
+}
+
+void lbuffer::append_varint( uint64_t val )
+{
+    reserve( _size + 10 ); // 64位整数最多10个字节
+
+    unsigned char *ptr = (unsigned char *)( _buff + _size );
+    while ( val >= 0x80 )
+    {
+        *ptr++ = (unsigned char)( val | 0x80 );
+        val >>= 7;
+    }
+    *ptr++ = (unsigned char)val;
+
+    _size = (char *)ptr - _buff;
+}
+
+void lbuffer::overwrite( size_t offset,const void *data,size_t sz )
+{
+    if ( offset + sz > _size ) return;
+
+    memcpy( _buff + offset,data,sz );
+}
+
+lreader::lreader( const char *data,size_t sz )
+{
+    _cur = data;
+    _end = data + sz;
+}
+
+bool lreader::read( void *data,size_t sz )
+{
+    const char *ptr = skip( sz );
+    if ( !ptr ) return false;
+
+    memcpy( data,ptr,sz );
+    return true;
+}
+
+bool lreader::read_varint( uint64_t &val )
+{
+    val = 0;
+    for ( int shift = 0;shift < 64 && _cur < _end;shift += 7 )
+    {
+        unsigned char byte = (unsigned char)*_cur++;
+        val |= (uint64_t)( byte & 0x7F ) << shift;
+
+        if ( !( byte & 0x80 ) ) return true;
+    }
+
+    _cur = _end; // 数据不完整或者超过10个字节
+    return false;
+}
+
+const char *lreader::skip( size_t sz )
+{
+    if ( sz > remain() )
+    {
+        _cur = _end;
+        return NULL;
+    }
+
+    const char *ptr = _cur;
+    _cur += sz;
+
+    return ptr;
+}
+
+/* crc32查表，在程序加载时初始化，多线程使用时不需要加锁 */
+static uint32_t crc_table[256];
+
+static struct crc_table_init
+{
+    crc_table_init()
+    {
+        for ( uint32_t i = 0;i < 256;i ++ )
+        {
+            uint32_t crc = i;
+            for ( int j = 0;j < 8;j ++ )
+            {
+                crc = ( crc & 1 ) ? ( crc >> 1 ) ^ 0xEDB88320 : crc >> 1;
+            }
+            crc_table[i] = crc;
+        }
+    }
+}crc_init;
+
+uint32_t lcrc32( const void *data,size_t sz,uint32_t crc )
+{
+    const unsigned char *ptr = (const unsigned char *)data;
+
+    crc = ~crc;
+    for ( size_t i = 0;i < sz;i ++ )
+    {
+        crc = crc_table[( crc ^ ptr[i] ) & 0xFF] ^ ( crc >> 8 );
+    }
+
+    return ~crc;
+}
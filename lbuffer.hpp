@@ -0,0 +1,69 @@
+#ifndef __LBUFFER_H__
+#define __LBUFFER_H__
+
+#include <cstddef>
+#include <stdint.h>
+
+/* 连续的二进制缓冲区，用于序列化
+ * 整数使用varint编码(有符号数先zigzag)，其他数据按原始字节写入
+ */
+class lbuffer
+{
+public:
+    ~lbuffer();
+    explicit lbuffer( size_t size = DEFAULT_SIZE );
+
+    void reserve( size_t size );
+    void append( const void *data,size_t sz );
+    void append_varint( uint64_t val );
+    void append_zigzag( int64_t val )
+    {
+        append_varint( ( (uint64_t)val << 1 ) ^ (uint64_t)( val >> 63 ) );
+    }
+
+    // 修改已写入的数据，如回填文件头
+    void overwrite( size_t offset,const void *data,size_t sz );
+
+    inline void clear() { _size = 0; }
+    inline char  *data() const { return _buff; }
+    inline size_t size() const { return _size; }
+private:
+    const static size_t DEFAULT_SIZE = 4096;
+
+    char  *_buff;
+    size_t _size;
+    size_t _capacity;
+};
+
+/* 从一段内存中读取lbuffer写入的数据，不拷贝内存
+ * 数据不足或者格式错误时返回false，之后的读取都会失败
+ */
+class lreader
+{
+public:
+    explicit lreader( const char *data,size_t sz );
+
+    bool read( void *data,size_t sz );
+    bool read_varint( uint64_t &val );
+    bool read_zigzag( int64_t &val )
+    {
+        uint64_t uval = 0;
+        if ( !read_varint( uval ) ) return false;
+
+        val = (int64_t)( uval >> 1 ) ^ -(int64_t)( uval & 1 );
+        return true;
+    }
+
+    // 跳过sz字节，返回这些数据的指针
+    const char *skip( size_t sz );
+
+    inline size_t remain() const { return _end - _cur; }
+private:
+    const char *_cur;
+    const char *_end;
+};
+
+// crc32(IEEE 802.3)，crc为之前数据的校验值，用于分段计算
+uint32_t lcrc32( const void *data,size_t sz,uint32_t crc = 0 );
+
+#endif /* __LBUFFER_H__ */
@@ -1,18 +1,32 @@
 #include "linsertion_ranking.hpp"
+#include "lsnapshot.hpp"
+#include "lshared.hpp"
+#include "lmerge.hpp"
 
 #include <cmath>
 #include <cerrno>
 #include <cassert>
+#include <climits>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <fstream>      // std::ofstream
+#include <vector>
+#include <algorithm>    // std::sort
 
 #define LIB_NAME "lua_insertion_ranking"
+#define SNAPSHOT_NAME "lua_insertion_ranking_snapshot"
+#define SHARED_NAME "lua_insertion_ranking_shared"
+#define MERGE_NAME "lua_insertion_ranking_merge"
 
 #define array_resize(type,base,cur,size)            \
     do{                                             \
         type *tmp = new type[size];                 \
         memset( tmp,0,sizeof(type)*size );          \
-        memcpy( tmp,base,sizeof(type)*cur );        \
+        if ( cur > 0 )                              \
+            memcpy( tmp,base,sizeof(type)*cur );    \
         delete []base;                              \
         base = tmp;                                 \
         cur = size;                                 \
@@ -34,7 +48,18 @@ static const char* error_msg[] =
     /* 10 */ "(illegal file)element string value error",
     /* 11 */ "(illegal file)can not update element value",
     /* 12 */ "end of file",
-    /* 13 */ "ranking list must be empty when load data from file"
+    /* 13 */ "ranking list must be empty when load data from file",
+    /* 14 */ "factor out of packed range",
+    /* 15 */ "ranking list must be empty when set packed factor",
+    /* 16 */ "packed factor bits illegal",
+    /* 17 */ "(illegal file)checksum error",
+    /* 18 */ "(illegal file)unsupported file version",
+    /* 19 */ "(illegal file)not a snapshot file",
+    /* 20 */ "(illegal file)journal record error",
+    /* 21 */ "ranking list must be empty when set decay",
+    /* 22 */ "packed factor and decay can not be used together",
+    /* 23 */ "decay half life or factor index illegal",
+    /* 24 */ "ranking list in decay mode can not be merged"
 };
 
 static void raise_error( lua_State *L,int err_code )
@@ -54,6 +79,7 @@ static void raise_error( lua_State *L,int err_code )
 static lir::lval_t lua_toelement( lua_State *L,int index )
 {
     lir::lval_t lval;
+    lval._sf = lir::LSF_PTR;
 
     switch ( lua_type( L,index ) )
     {
@@ -103,7 +129,7 @@ static void lua_pushelement( lua_State *L,const lir::lval_t &val )
         case lir::LVT_BOOLEAN : lua_pushboolean( L,val._v._int ); break;
         case lir::LVT_INTEGER : lua_pushinteger( L,val._v._int ); break;
         case lir::LVT_NUMBER  : lua_pushnumber ( L,val._v._num ); break;
-        case lir::LVT_STRING  : lua_pushstring ( L,val._v._str ); break;
+        case lir::LVT_STRING  : lua_pushstring ( L,lir::lval_str( val ) ); break;
         default: lua_pushnil( L );
     }
 }
@@ -123,7 +149,7 @@ static void lua_pushintegerornumber( lua_State *L,double v )
 
 lir::~lir()
 {
-    for ( int i = 0;i < _cur_size;i ++ )
+    for ( int i = 0;_list && i < _cur_size;i ++ )
     {
         del_element( *(_list + i) );
     }
@@ -131,10 +157,24 @@ lir::~lir()
     delete []_list;
     _list = NULL;
 
+    delete []_skey;
+    _skey = NULL;
+
+    tree_free( _root );
+    _root = NULL;
+
+    // 内存池中的内存在这里一次性释放
+    for ( int i = 0;i < VALUE_POOL;i ++ )
+    {
+        delete _vpool[i];
+        _vpool[i] = NULL;
+    }
+
     _kmap.clear();
 }
 
-lir::lir( const char *path )
+lir::lir( const char *path,int backend )
+    : _jpending( 256 ),_epool( sizeof(element_t) ),_npool( sizeof(tnode_t) )
 {
     // snprintf
     size_t sz = strlen( path );
@@ -143,13 +183,56 @@ lir::lir( const char *path )
     _path[sz]  = 0;
     memcpy( _path,path,sz );
 
+    _backend   = backend;
+    _root      = NULL;
+    _seed      = 2463534242u;
+
     _cur_size  = 0;
-    _max_size  = DEFAULT_VALUE;
-    _list = new element_t*[DEFAULT_VALUE];
-    memset( _list,0,sizeof(element_t*)*_max_size );
+    _max_size  = 0;
+    _list      = NULL;
+    _skey      = NULL;
+    if ( BK_ARRAY == _backend ) reserve( DEFAULT_VALUE );
 
     _modify = false;
     _cur_factor = 0;
+
+    _packed = 0;
+    memset( _pbits,0,sizeof(_pbits) );
+
+    _intern_on = false;
+
+    _limit = 0;
+
+    _decay_index = -1;
+    _half_life   = 0;
+    _decay_base  = 0;
+    _decay_clock = 0;
+
+    _seq       = 0;
+    _track_cap = 0;
+    _track_min = 0;
+
+    _stat_on = false;
+    reset_stats();
+
+    _watch_cap  = 0;
+    _watch_top  = 0;
+    _th_cnt     = 0;
+    _ev_head    = 0;
+    _ev_cnt     = 0;
+    _ev_dropped = 0;
+
+    _journal_on   = false;
+    _compact      = true;
+    _generation   = 0;
+    _base_size    = 0;
+    _journal_size = 0;
+
+    // 变量数组按DEFAULT_VALUE*2^n分配，每种大小一个内存池
+    for ( int i = 0;i < VALUE_POOL;i ++ )
+    {
+        _vpool[i] = new lpool( sizeof(lval_t)*(DEFAULT_VALUE << i) );
+    }
 }
 
 char *lir::new_string( const char *str,size_t sz )
@@ -171,48 +254,76 @@ void lir::del_string( const char *str )
 
 void lir::del_lval( const lval_t &lval )
 {
-    if ( lval._vt == LVT_STRING )
+    if ( lval._vt != LVT_STRING ) return;
+
+    switch ( lval._sf )
     {
-        del_string( lval._v._str );
+        case LSF_PTR    : del_string( lval._v._str ); break;
+        case LSF_INTERN : _intern.release( lval._v._str ); break;
+        default : break; // LSF_INLINE不需要释放
     }
 }
 
+/* 拷贝变量，to原来的字符串会被释放
+ * 短字符串直接存放在lval_t中，开启常量池时长字符串只保存一份
+ */
 void lir::cpy_lval( lval_t &to,const lval_t &from )
 {
-    if ( to._vt == LVT_STRING )
-    {
-        if ( from._vt == LVT_STRING )
-        {
-            size_t sz = strlen(to._v._str);
-            if ( sz >= strlen(from._v._str) )
-            {
-                memcpy( to._v._str,from._v._str,sz );
-                return;
-            }
-            else
-            {
-                del_string( to._v._str );
-                to._v._str = new_string( from._v._str );
+    del_lval( to );
 
-                return;
-            }
-        }
-        del_string( to._v._str );
+    if ( from._vt != LVT_STRING )
+    {
+        to = from;
+        return;
     }
 
-    to._vt = from._vt;
+    const char *str = lval_str( from );
+    size_t sz = strlen( str );
 
-    if ( from._vt != LVT_STRING )
+    to._vt = LVT_STRING;
+    if ( sz < (size_t)SSO_SIZE )
     {
-        to._v  = from._v ;
+        to._sf = LSF_INLINE;
+        memcpy( to._v._sso,str,sz + 1 );
+    }
+    else if ( _intern_on )
+    {
+        to._sf = LSF_INTERN;
+        to._v._str = const_cast<char *>( _intern.acquire( str,sz ) );
     }
     else
     {
-        to._v._str = new_string( from._v._str );
+        to._sf = LSF_PTR;
+        to._v._str = new_string( str,sz );
     }
 }
 
-void lir::del_element( const element_t *element )
+/* 分配变量数组，sz必须是DEFAULT_VALUE*2^n */
+lir::lval_t *lir::new_value( int sz )
+{
+    int index = 0;
+    while ( (DEFAULT_VALUE << index) < sz ) index ++;
+
+    assert( index < VALUE_POOL && (DEFAULT_VALUE << index) == sz );
+
+    if ( _stat_on ) _stat._alloc ++;
+    lval_t *val = (lval_t *)_vpool[index]->alloc();
+    memset( val,0,sizeof(lval_t)*sz ); // 预留
+
+    return val;
+}
+
+void lir::del_value( lval_t *val,int sz )
+{
+    int index = 0;
+    while ( (DEFAULT_VALUE << index) < sz ) index ++;
+
+    assert( index < VALUE_POOL && (DEFAULT_VALUE << index) == sz );
+
+    _vpool[index]->free( val );
+}
+
+void lir::del_element( element_t *element )
 {
     if ( element->_val )
     {
@@ -221,811 +332,3962 @@ void lir::del_element( const element_t *element )
             del_lval( *(element->_val + i) );
         }
 
-        delete []element->_val;
+        del_value( element->_val,element->_vsz );
     }
 
-    delete element;
+    _epool.free( element );
 }
 
 /* 对比排序因子
  * @fsrc @fdest 是一个大小为MAX_FACTOR的数组
+ * 未使用的排序因子都为0，因此可以固定对比MAX_FACTOR个，循环次数固定且没有分支，
+ * 编译器可以展开或者向量化
  */
 int lir::compare( const factor_t *fsrc,const factor_t *fdest )
 {
-    assert( _cur_factor > 0 );
-
-    for ( int i = 0;i < _cur_factor;i ++ )
+    int cmp = 0;
+    for ( int i = MAX_FACTOR - 1;i >= 0;i -- )
     {
-        if ( fsrc[i] > fdest[i] )
-        {
-            return 1;
-        }
-        else if ( fsrc[i] < fdest[i] )
-        {
-            return -1;
-        }
+        int gt = fsrc[i] > fdest[i];
+        int lt = fsrc[i] < fdest[i];
+
+        cmp = ( gt | lt ) ? gt - lt : cmp;
     }
 
-    return 0;
+    return cmp;
 }
 
-/* 向前移动元素 */
-int lir::shift_up( element_t *element )
+/* 设置压缩排序因子，每个排序因子占用的位数，总共不能超过128位
+ * 排序因子必须是[0,2^bits)之间的整数，所有排序因子按顺序压缩成一个128位的整数，
+ * 对比排序因子时只需要对比一到两个整数
+ */
+int lir::set_packed( const int *bits,int cnt )
 {
-    /* _pos是排名，从1开始
-     * element->_pos - 2是取排在element前一个元素索引(从0开始)
-     */
-    for ( int index = element->_pos - 2;index >= 0;index -- )
-    {
-        element_t *element_up = *(_list + index);
+    if ( 0 != _cur_size ) return 15;
+    if ( cnt < 0 || cnt > MAX_FACTOR ) return 16;
+    if ( cnt > 0 && _decay_index >= 0 ) return 22;
 
-        if ( compare( element,element_up ) <= 0 ) break;
+    int total = 0;
+    for ( int i = 0;i < cnt;i ++ )
+    {
+        if ( bits[i] <= 0 || bits[i] > 64 ) return 16;
 
-        // 交换位置
-        element->_pos --;
-        element_up->_pos ++;
-        *(_list + index + 1) = element_up;
+        total += bits[i];
     }
 
-    assert( element->_pos > 0 && element->_pos <= _cur_size );
+    if ( total > 128 ) return 16;
 
-    *(_list + element->_pos - 1) = element;
-    return element->_pos;
+    _packed = cnt;
+    memset( _pbits,0,sizeof(_pbits) );
+    memcpy( _pbits,bits,sizeof(int)*cnt );
+
+    return 0;
 }
 
-/* 向后移动元素 */
-int lir::shift_down( element_t *element )
+/* 检查排序因子是否能压缩 */
+int lir::check_factor( int index,factor_t factor )
 {
-    for ( int index = element->_pos;index <= _cur_size - 1;index ++ )
-    {
-        element_t *element_down = *(_list + index);
+    if ( !_packed ) return 0;
 
-        if ( compare( element,element_down ) >= 0 ) break;
+    if ( index >= _packed ) return 0 == factor ? 0 : 14;
 
-        // 交换
-        element->_pos ++;
-        element_down->_pos --;
-
-        *(_list + index - 1) = element_down;
+    // 2^bits，bits为64时也能用double准确表示
+    factor_t max = std::ldexp( 1.0,_pbits[index] );
+    if ( factor < 0 || factor >= max || factor != std::floor( factor ) )
+    {
+        return 14;
     }
 
-    assert( element->_pos > 0 && element->_pos <= _cur_size );
-
-    *(_list + element->_pos - 1) = element;
-    return element->_pos;
+    return 0;
 }
 
-/* 添加新元素到排行 */
-int lir::append( key_t key,factor_t *factor )
+int lir::check_factor( const factor_t *factor )
 {
-    assert( _cur_size <= _max_size );
-    if ( _cur_size == _max_size )
+    for ( int i = 0;_packed && i < MAX_FACTOR;i ++ )
     {
-        array_resize( element_t*,_list,_max_size,_max_size*2 );
+        int err = check_factor( i,factor[i] );
+        if ( err ) return err;
     }
 
-    element_t *element = new element_t();
-    element->_vsz = 0   ;
-    element->_key = key ;
-    element->_val = NULL;
-    
-    /* factor必须按MAX_FACTOR初始化。必须全部拷贝，以初始化element._factor */
-    memcpy( element->_factor,factor,sizeof( element->_factor ) );
+    return 0;
+}
 
-    _kmap[key]           = element;
-    *(_list + _cur_size) = element;
+/* 根据排序因子生成_skey */
+void lir::make_key( skey_t &key,const factor_t *factor )
+{
+    if ( !_packed )
+    {
+        memcpy( key._factor,factor,sizeof(key._factor) );
+        return;
+    }
 
-    _cur_size++;
-    element->_pos = _cur_size;
+    uint64_t hi = 0;
+    uint64_t lo = 0;
+    for ( int i = 0;i < _packed;i ++ )
+    {
+        int bits    = _pbits[i];
+        uint64_t v  = (uint64_t)factor[i];
+        if ( 64 == bits )
+        {
+            hi = lo;
+            lo = v;
+        }
+        else
+        {
+            hi = ( hi << bits ) | ( lo >> (64 - bits) );
+            lo = ( lo << bits ) | v;
+        }
+    }
 
-    return shift_up( element );
+    key._pk._hi = hi;
+    key._pk._lo = lo;
 }
 
-/* 更新排序因子，不存在则尝试插入 */
-int lir::update_factor( key_t key,factor_t *factor,int factor_cnt,int &old_pos )
+/* 分配_list、_skey的内存(BK_ARRAY) */
+void lir::reserve( int size )
 {
-    _modify = true;
-
-    // 自动更新全局最大排序因子(必须在compare、memcpy之前更新)
-    if ( factor_cnt > _cur_factor ) _cur_factor = factor_cnt;
+    if ( size <= _max_size ) return;
 
-    kmap_iterator itr = _kmap.find( key );
-    if ( itr == _kmap.end() )
-    {
-        old_pos = 0;
-        return append( key,factor );
-    }
+    int sz = _max_size > 0 ? _max_size : DEFAULT_VALUE;
+    while ( sz < size ) sz *= 2;
 
-    element_t *element = itr->second;
+    int max_size = _max_size;
+    array_resize( skey_t,_skey,max_size,sz );
+    array_resize( element_t*,_list,_max_size,sz );
+}
 
-    old_pos = element->_pos;
-    int shift = compare( element->_factor,factor );
+/* 在_list、_skey中把[src,src + n)移动到dst */
+void lir::move( int dst,int src,int n )
+{
+    if ( n <= 0 ) return;
 
-    if ( 0 == shift ) return old_pos; // no change
+    memmove( _list + dst,_list + src,sizeof(element_t *)*n );
+    memmove( _skey + dst,_skey + src,sizeof(skey_t)*n );
+}
 
-    /* factor必须按MAX_FACTOR初始化。必须全部拷贝，以初始化element._factor */
-    memcpy( element->_factor,factor,sizeof( element->_factor ) );
-    return shift > 0 ? shift_up( element ) : shift_down( element );
+/* 把元素放到index，排序因子也拷贝到_skey */
+void lir::place( int index,element_t *element )
+{
+    *(_list + index) = element;
+    make_key( *(_skey + index),element->_factor );
 }
 
-/* 更新单个排序因子，不存在则尝试插入 */
-int lir::update_one_factor( key_t key,factor_t factor,int index,int &old_pos )
+/* 向前移动元素
+ * 只有element的_pos会被更新，被挤开的元素_pos在下次position时再修正
+ */
+int lir::shift_up( element_t *element )
 {
-    _modify = true;
+    /* _pos是排名，从1开始,cur是element当前的索引(从0开始) */
+    int cur = element->_pos - 1;
+    assert( cur >= 0 && cur < _cur_size && *(_list + cur) == element );
 
-    // 自动更新全局最大排序因子(必须在compare、memcpy之前更新)
-    if ( index > _cur_factor ) _cur_factor = index;
+    /* [index,cur)内的元素都比element小，则element要移到index
+     * 先倍增找到大致范围，再二分。小幅度变化时和逐个对比一样快，大幅度变化时为O(logn)
+     */
+    skey_t key;
+    make_key( key,element->_factor );
 
-    index --; // C++ 从0开始，lua从1开始
-    kmap_iterator itr = _kmap.find( key );
-    if ( itr == _kmap.end() )
+    int bound = 1;
+    while ( bound <= cur && compare_key( &key,_skey + cur - bound ) > 0 )
     {
-        factor_t flist[MAX_FACTOR] = { 0 };
-        flist[index] = factor;
-        return append( key,flist );
+        bound <<= 1;
     }
 
-    element_t *element = itr->second;
-
-    old_pos = element->_pos;
-    if ( element->_factor[index] == factor )
+    int lo = bound > cur ? 0 : cur - bound + 1;
+    int hi = cur - bound/2;
+    while ( lo < hi )
     {
-        return old_pos;
+        int mid = ( lo + hi ) >> 1;
+        if ( compare_key( &key,_skey + mid ) > 0 )
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
     }
 
-    int shift = factor > element->_factor[index] ? 1 : -1;
+    move( lo + 1,lo,cur - lo );
+    place( lo,element );
 
-    element->_factor[index] = factor;
-    return shift > 0 ? shift_up( element ) : shift_down( element );
+    element->_pos = lo + 1;
+    return element->_pos;
 }
 
-/* 打印整个排行榜数据 */
-void lir::raw_dump( std::ostream &os )
+/* 向后移动元素 */
+int lir::shift_down( element_t *element )
 {
-    // print header
-    os << "position";
-    for ( int i = 0;i < _cur_factor;i ++ )
-    {
-        os << '\t' << "factor" << i + 1;
-    }
+    int cur = element->_pos - 1;
+    assert( cur >= 0 && cur < _cur_size && *(_list + cur) == element );
 
-    os << '\t' << "values ..." << std::endl;
+    // (cur,index]内的元素都比element大，则element要移到index
+    skey_t key;
+    make_key( key,element->_factor );
 
-    for ( int index = 0;index < _cur_size;index ++ )
+    int bound = 1;
+    while ( cur + bound < _cur_size && compare_key( &key,_skey + cur + bound ) < 0 )
     {
-        const element_t *e = *(_list + index);
-
-        // print position and key
-        os << index + 1 << '\t' << e->_key;
+        bound <<= 1;
+    }
 
-        // print all factor
-        for ( int findex = 0;findex < _cur_factor;findex ++ )
+    int lo = cur + bound/2;
+    int hi = cur + bound - 1;
+    if ( hi > _cur_size - 1 ) hi = _cur_size - 1;
+    while ( lo < hi )
+    {
+        int mid = ( lo + hi + 1 ) >> 1;
+        if ( compare_key( &key,_skey + mid ) < 0 )
         {
-            os << '\t' << e->_factor[findex];
+            lo = mid;
         }
-
-        // print all value
-        for ( int hindex = 0;hindex < e->_vsz;hindex ++ )
+        else
         {
-            const lval_t &lval = e->_val[hindex];
-            switch ( lval._vt )
-            {
-                case LVT_UNDEF   : os << '\t';break;
-                case LVT_NIL     : os << '\t' << "nil";break;
-                case LVT_BOOLEAN : 
-                    os << "\t" << (lval._v._int ? "true" : "false");break;
-                case LVT_INTEGER : os << '\t' << lval._v._int;break;
-                case LVT_NUMBER  : os << '\t' << lval._v._num;break;
-                case LVT_STRING  : os << '\t' << lval._v._str;break;
-            }
+            hi = mid - 1;
         }
-
-        os << std::endl;
     }
-}
-
-/* 打印到std::cout还是文件 */
-void lir::dump( const char *path )
-{
-    if ( path )
-    {
-        std::ofstream ofs( path,std::ofstream::app );
-        if ( ofs.good() )
-        {
-            raw_dump( ofs );
-            ofs.close    ();
 
-            return;
-        }
-    }
+    move( cur,cur + 1,lo - cur );
+    place( lo,element );
 
-    raw_dump( std::cout );
+    element->_pos = lo + 1;
+    return element->_pos;
 }
 
-/*
- * !!!! @lval should not need to delete mmemory here
+/* 查找元素在_list中的索引，用于修正过期的_pos
+ * _list是按排序因子有序的，二分找到排序因子相同的区间[lo,end)。区间内的顺序
+ * 和key无关，只能逐个对比：从过期的_pos开始向两边查找，耗时取决于_pos偏离了
+ * 多少(期间前面插入、删除的数量)，而不是相同排序因子的元素数量
  */
-int lir::update_one_value( key_t key,int index,const lval_t &lval )
+int lir::locate( const element_t *element )
 {
-    _modify = true;
+    skey_t key;
+    make_key( key,element->_factor );
 
-    kmap_iterator itr = _kmap.find( key );
-    if ( itr == _kmap.end() )
+    int lo = 0;
+    int hi = _cur_size;
+    while ( lo < hi )
     {
-        return 1;
+        int mid = ( lo + hi ) >> 1;
+        if ( compare_key( _skey + mid,&key ) > 0 )
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
     }
 
-    if ( index < 0 || index >= MAX_VALUE ) return 3;
-
-    element_t *element = itr->second;
-    if ( !element->_val )
+    // 排序因子相同区间的结束位置
+    int end = _cur_size;
+    hi = lo;
+    while ( hi < end )
     {
-        int sz = DEFAULT_VALUE;
-        while ( sz < index ) sz *=2;
-
-        element->_vsz = sz;
-        element->_val = new lval_t[sz];
-        memset( element->_val,0,sizeof(lval_t)*sz ); // 预留
+        int mid = ( hi + end ) >> 1;
+        if ( compare_key( _skey + mid,&key ) >= 0 )
+        {
+            hi = mid + 1;
+        }
+        else
+        {
+            end = mid;
+        }
     }
-    else if ( element->_vsz <= index )
-    {
-        int sz = element->_vsz;
-        while ( sz <= index ) sz *=2;
 
-        array_resize( lval_t,element->_val,element->_vsz,sz );
-    }
+    int hint = element->_pos - 1;
+    if ( hint < lo ) hint = lo;
+    if ( hint >= end ) hint = end - 1;
 
-    cpy_lval( *(element->_val + index),lval );// delete old value memory
+    for ( int dist = 0;hint - dist >= lo || hint + dist < end;dist ++ )
+    {
+        if ( hint + dist < end && *(_list + hint + dist) == element ) return hint + dist;
+        if ( hint - dist >= lo && *(_list + hint - dist) == element ) return hint - dist;
+    }
 
-    return 0;
+    assert( false );
+    return -1;
 }
 
-// 获取排序因子
-int lir::get_factor( key_t key,factor_t **factor )
+/* 创建新元素，只加入_kmap，还未加入排行 */
+lir::element_t *lir::new_element( key_t key,const factor_t *factor )
 {
-    kmap_iterator itr = _kmap.find( key );
-    if ( itr == _kmap.end() ) return    0;
+    if ( _stat_on ) _stat._alloc ++;
 
-    *factor = itr->second->_factor;
+    element_t *element = (element_t *)_epool.alloc();
+    memset( element,0,sizeof(element_t) );
 
-    return _cur_factor;
-}
-
-// 获取变量
-int lir::get_value( key_t key,lval_t **val )
-{
-    kmap_iterator itr = _kmap.find( key );
-    if ( itr == _kmap.end() ) return    0;
+    element->_vsz  = 0   ;
+    element->_key  = key ;
+    element->_val  = NULL;
+    element->_node = NULL;
+    
+    /* factor必须按MAX_FACTOR初始化。必须全部拷贝，以初始化element._factor */
+    memcpy( element->_factor,factor,sizeof( element->_factor ) );
 
-    *val = itr->second->_val;
+    _kmap.set( key,element );
 
-    return itr->second->_vsz;
+    return element;
 }
 
-// 获取变量
-lir::key_t *lir::get_key( int pos )
+/* 添加新元素到排行
+ * 排行已满(set_max_size)时，不比最后一名大则直接丢弃，返回0
+ */
+int lir::append( key_t key,const factor_t *factor )
 {
-    if ( pos < 0 || pos >= _cur_size ) return NULL;
-
-    return &((*(_list + pos))->_key);
-}
+    if ( _limit <= 0 || _cur_size < _limit )
+    {
+        return insert( new_element( key,factor ) );
+    }
 
-// 根据key获取所在排名
-int lir::get_position( const key_t &key )
-{
-    kmap_iterator itr = _kmap.find( key );
-    if ( itr == _kmap.end() ) return    0;
+    element_t *last = seek( _cur_size - 1 );
+    if ( compare( factor,last->_factor ) <= 0 ) return 0;
 
-    return itr->second->_pos;
+    return insert( recycle( last,key,factor ) );
 }
 
-// 删除一个元素
-int lir::del( const key_t &key )
+/* 把最后一名移出排行，重新作为新元素使用，减少内存分配
+ * 被挤出的元素记录为删除，重放日志时不需要设置同样的最大数量
+ */
+lir::element_t *lir::recycle( element_t *last,key_t key,const factor_t *factor )
 {
-    _modify = true;
+    journal_del( last->_key );
+    _kmap.erase( last->_key );
+    track_del( last->_key,_cur_size,_cur_size );
 
-    kmap_iterator itr = _kmap.find( key );
-    if ( itr == _kmap.end() )
+    --_cur_size;
+    if ( BK_TREE == _backend )
     {
-        return 0;
+        tree_remove( last->_node );
+    }
+    else
+    {
+        *(_list + _cur_size) = NULL;
     }
 
-    // 当前元素后的都往前移动一个位置
-    int pos = itr->second->_pos;
-    for ( int index = pos;index < _cur_size;index ++ )
+    // 保留变量数组，只清空变量
+    for ( int i = 0;last->_val && i < last->_vsz;i ++ )
     {
-        (*(_list + index))->_pos --;
-        *(_list + index - 1) = *(_list + index);
+        del_lval( *(last->_val + i) );
     }
+    if ( last->_val ) memset( last->_val,0,sizeof(lval_t)*last->_vsz );
 
-    *(_list + _cur_size - 1) = NULL;
+    last->_key = key;
+    memcpy( last->_factor,factor,sizeof( last->_factor ) );
 
-    --_cur_size;
-    del_element( itr->second );
-    _kmap.erase( itr         );
+    _kmap.set( key,last );
 
-    return pos;
+    return last;
 }
 
-// 保存到文件
-// @f 是否强制保存文件(force)
-int lir::save( int f )
+/* 设置排行最大数量，0表示不限制。超出的元素从最后一名开始删除 */
+void lir::set_max_size( int max_size )
 {
-    if ( !f && !_modify ) return 0; // no need to save
-
-    std::ofstream ofs( _path,std::ofstream::trunc | std::ofstream::binary );
-    if ( !ofs.good() ) return -1;
-
-    ofs.write( (char*)&_cur_factor,sizeof(_cur_factor) );
+    _limit = max_size > 0 ? max_size : 0;
 
-    ofs.write( (char*)&_cur_size,sizeof(_cur_size) );
-    for ( int i = 0;i < _cur_size;i ++ )
+    while ( _limit > 0 && _cur_size > _limit )
     {
-        const element_t *element = *(_list + i);
+        del( seek( _cur_size - 1 )->_key );
+    }
+}
 
-        ofs.write( (char*)&(element->_key),sizeof(element->_key) );
-        for ( int findex = 0;findex < _cur_factor;findex ++ )
+/* 把new_element创建的元素加入排行 */
+int lir::insert( element_t *element )
+{
+    if ( BK_TREE == _backend )
+    {
+        if ( !element->_node )
         {
-            ofs.write( (char*)&(element->_factor[findex]),sizeof(factor_t) );
+            if ( _stat_on ) _stat._alloc ++;
+            element->_node = (tnode_t *)_npool.alloc();
         }
+        element->_node->_element = element;
 
-        ofs.write( (char*)&element->_vsz,sizeof(element->_vsz) );
+        _cur_size++;
+        return tree_insert( element->_node,1 );
+    }
 
-        for ( int vindex = 0;vindex < element->_vsz;vindex ++ )
-        {
-            const lval_t &lval = element->_val[vindex];
+    reserve( _cur_size + 1 );
+    place( _cur_size,element );
 
-            ofs.write( (char*)&lval._vt,sizeof(lval._vt) );
-            switch ( lval._vt )
-            {
-                case LVT_UNDEF   : // fall through
-                case LVT_NIL     : break;
-                case LVT_BOOLEAN : // fall through
-                case LVT_INTEGER :
-                    ofs.write( (char*)&lval._v._int,sizeof(lval._v._int) );break;
-                case LVT_NUMBER  :
-                    ofs.write( (char*)&lval._v._num,sizeof(lval._v._num) );break;
-                case LVT_STRING  : write_string( ofs,lval._v._str ); break;
-            }
+    _cur_size++;
+    element->_pos = _cur_size;
+
+    return shift_up( element );
+}
+
+/* 对元素排序：排序因子大的在前，相同则_pos小的在前
+ * 批量合并时_pos为处理顺序，向下移动的为负数，见update_factors
+ */
+struct lir::batch_greater
+{
+    lir *_lir;
+    explicit batch_greater( lir *l ) : _lir( l ) {}
+
+    bool operator()( const element_t *a,const element_t *b ) const
+    {
+        int cmp = _lir->compare( a,b );
+        return 0 != cmp ? cmp > 0 : a->_pos < b->_pos;
+    }
+};
+
+/* 批量更新时按key排序，key相同则按传入的顺序 */
+struct lir::batch_key_less
+{
+    const update_t *_updates;
+    explicit batch_key_less( const update_t *u ) : _updates( u ) {}
+
+    bool operator()( int a,int b ) const
+    {
+        if ( _updates[a]._key != _updates[b]._key )
+        {
+            return _updates[a]._key < _updates[b]._key;
         }
+
+        return a < b;
     }
+};
 
-    _modify = false;
+/* 把元素合并到_list中(BK_ARRAY)
+ * @elements 需要重新排序的元素，包括新元素
+ * @removed elements中原来就在_list中的元素索引
+ */
+void lir::merge( const std::vector<element_t *> &elements,std::vector<int> &removed )
+{
+    // 从_list中移出，只需要处理第一个移出元素之后的部分
+    std::sort( removed.begin(),removed.end() );
+
+    int size = _cur_size;
+    if ( !removed.empty() )
+    {
+        size_t r = 0;
+        size = removed[0];
+        for ( int index = size;index < _cur_size;index ++ )
+        {
+            if ( r < removed.size() && removed[r] == index )
+            {
+                r ++;
+                continue;
+            }
+
+            *(_list + size  ) = *(_list + index);
+            *(_skey + size++) = *(_skey + index);
+        }
+    }
+
+    // 不能改变调用者中的顺序，和更新前的排名一一对应
+    std::vector<element_t *> moved( elements );
+    std::sort( moved.begin(),moved.end(),batch_greater( this ) );
+
+    int total = size + (int)moved.size();
+    reserve( total );
 
-    ofs.close();
-    return    1;
+    // 从后往前合并，排序因子相同的，向下移动的排在未变化的元素前面，
+    // 新元素及向上移动的排在后面，和逐个移动的顺序一样
+    int i = size - 1;
+    int j = (int)moved.size() - 1;
+    int k = total - 1;
+
+    skey_t key;
+    if ( j >= 0 ) make_key( key,moved[j]->_factor );
+    while ( j >= 0 )
+    {
+        int cmp = i >= 0 ? compare_key( _skey + i,&key ) : 1;
+        if ( cmp < 0 || ( 0 == cmp && moved[j]->_pos < 0 ) )
+        {
+            *(_list + k) = *(_list + i);
+            *(_skey + k) = *(_skey + i);
+            k --;
+            i --;
+        }
+        else
+        {
+            moved[j]->_pos = k + 1;
+            *(_list + k) = moved[j];
+            *(_skey + k) = key;
+            k --;
+
+            if ( --j >= 0 ) make_key( key,moved[j]->_factor );
+        }
+    }
+
+    _cur_size = total;
 }
 
-int lir::load()
+/* 把元素一次合并到树中(BK_TREE)，顺序和merge一样：先移出所有元素，再按
+ * 处理顺序插入，向下移动的插入到排序因子相同的元素前面，否则插入到后面
+ */
+void lir::tree_merge( const std::vector<element_t *> &moved )
 {
-    enum step
+    for ( size_t k = 0;k < moved.size();k ++ )
     {
-        ST_FCNT = 0,  // 读取排序因子数量
-        ST_ECNT    ,  // 读取元素数量
-        ST_EKEY    ,  // element key
-        ST_EFCT    ,  // element factor
-        ST_EVSZ    ,  // element value size
-        ST_EVAL    ,  // element value
-        ST_FCHK    ,  // finish check
-        ST_DONE       // 完成
-    };
+        if ( moved[k]->_node ) tree_remove( moved[k]->_node );
+    }
 
-    if ( 0 != _cur_size ) return 13;
+    for ( size_t k = 0;k < moved.size();k ++ )
+    {
+        if ( moved[k]->_node )
+        {
+            tree_insert( moved[k]->_node,moved[k]->_pos > 0 ? 1 : -1 );
+        }
+        else
+        {
+            insert( moved[k] );
+        }
+    }
+}
 
-    std::ifstream ifs( _path,std::ifstream::in );
-    if ( !ifs.good() || ifs.peek() == std::ifstream::traits_type::eof() )
+/* 排序因子变化后调整元素位置 */
+int lir::reposition( element_t *element,int shift )
+{
+    if ( BK_TREE == _backend )
     {
-        return 0;
+        tree_remove( element->_node );
+        return tree_insert( element->_node,shift );
     }
 
-    int step = ST_FCNT;
-    int cur_size   = 0;
+    return shift > 0 ? shift_up( element ) : shift_down( element );
+}
 
-    key_t key;
+/* 元素当前排名
+ * BK_ARRAY下_pos只是一个缓存，元素被其他元素挤开后不会立即更新。
+ * 取排名时先检查缓存的位置及其前后位置，大部分情况下都是O(1)
+ */
+int lir::position( element_t *element )
+{
+    if ( BK_TREE == _backend ) return tree_rank( element->_node );
 
-    int cur_factor  = 0;
-    int factor_size = 0;
-    factor_t factor[MAX_FACTOR];
+    int index = element->_pos - 1;
+    if ( index < _cur_size && *(_list + index) == element )
+    {
+        return element->_pos;
+    }
 
-    int vsz = 0;
-    int cur_vsz = 0;
+    if ( index > 0 && index <= _cur_size && *(_list + index - 1) == element )
+    {
+        index = index - 1;
+    }
+    else if ( index + 1 < _cur_size && *(_list + index + 1) == element )
+    {
+        index = index + 1;
+    }
+    else
+    {
+        index = locate( element );
+    }
 
-    int _errno = 0;
+    element->_pos = index + 1;
+    return element->_pos;
+}
 
-    while( ifs.good() && 0 == _errno )
+/* 根据排名取元素 */
+lir::element_t *lir::seek( int index )
+{
+    if ( index < 0 || index >= _cur_size ) return NULL;
+
+    if ( BK_TREE == _backend )
     {
-        switch( step )
+        return tree_select( index )->_element;
+    }
+
+    return *(_list + index);
+}
+
+/* 排在element(排名为index + 1)后面的元素 */
+lir::element_t *lir::next( const element_t *element,int index )
+{
+    if ( index + 1 >= _cur_size ) return NULL;
+
+    if ( BK_TREE == _backend )
+    {
+        return tree_next( element->_node )->_element;
+    }
+
+    return *(_list + index + 1);
+}
+
+/* 更新排序因子，不存在则尝试插入 */
+int lir::update_factor( key_t key,const factor_t *factor,int factor_cnt,int &old_pos )
+{
+    ltimer timer( _stat_on ? &_stat._update : NULL );
+    _modify = true;
+
+    // 自动更新全局最大排序因子(必须在compare、memcpy之前更新)
+    if ( factor_cnt > _cur_factor ) _cur_factor = factor_cnt;
+
+    // 变更日志在更新完成后才记录，被拒绝的更新不会写入日志
+    element_t *element = find_key( key );
+    if ( !element )
+    {
+        old_pos = 0;
+
+        int pos = append( key,factor );
+        if ( pos > 0 ) journal_factor( key,factor,factor_cnt );
+        return track_insert( pos );
+    }
+
+    old_pos = position( element );
+    int shift = compare( factor,element->_factor );
+
+    if ( 0 == shift ) return old_pos; // no change
+
+    /* factor必须按MAX_FACTOR初始化。必须全部拷贝，以初始化element._factor */
+    memcpy( element->_factor,factor,sizeof( element->_factor ) );
+
+    int pos = reposition( element,shift );
+    journal_factor( key,factor,factor_cnt );
+    track( element,old_pos,pos );
+
+    return pos;
+}
+
+/* 更新单个排序因子，不存在则尝试插入 */
+int lir::update_one_factor( key_t key,factor_t factor,int index,int &old_pos )
+{
+    ltimer timer( _stat_on ? &_stat._update : NULL );
+
+    old_pos = 0;
+    if ( index < 1 || index > MAX_FACTOR ) return 0;
+
+    _modify = true;
+
+    // 自动更新全局最大排序因子(必须在compare、memcpy之前更新)
+    if ( index > _cur_factor ) _cur_factor = index;
+
+    int lindex = index;
+    index --; // C++ 从0开始，lua从1开始
+    element_t *element = find_key( key );
+    if ( !element )
+    {
+        factor_t flist[MAX_FACTOR] = { 0 };
+        flist[index] = factor;
+
+        int pos = append( key,flist );
+        if ( pos > 0 ) journal_one_factor( key,factor,lindex );
+        return track_insert( pos );
+    }
+
+    old_pos = position( element );
+    if ( element->_factor[index] == factor )
+    {
+        return old_pos;
+    }
+
+    int shift = factor > element->_factor[index] ? 1 : -1;
+
+    element->_factor[index] = factor;
+
+    int pos = reposition( element,shift );
+    journal_one_factor( key,factor,lindex );
+    track( element,old_pos,pos );
+
+    return pos;
+}
+
+/* 批量更新排序因子，不存在则插入
+ * 同一个key多次更新只有最后一次生效，old_pos都是批量更新前的排名
+ * 更新的元素较多时(BK_ARRAY)，把这些元素从_list中移出，排序后再一次合并回去，
+ * 而不是逐个移动(BM_MERGE)。各种方式下排序因子相同的元素顺序都和按key的顺序逐个
+ * 更新一样：向上移动及新元素排在后面，向下移动的排在前面，两种后端也一样
+ * 重放日志时mode为记录的方式，和当前的排行设置无关，限制了最大数量时更新完再
+ * 删除超出的元素
+ */
+int lir::update_factors( const update_t *updates,int n,
+    int *new_pos,int *old_pos,int mode )
+{
+    ltimer timer( _stat_on ? &_stat._bulk : NULL );
+    if ( n <= 0 ) return 0;
+
+    _modify = true;
+
+    // 自动更新全局最大排序因子(必须在compare之前更新)
+    for ( int i = 0;i < n;i ++ )
+    {
+        if ( updates[i]._cnt > _cur_factor ) _cur_factor = updates[i]._cnt;
+    }
+
+    std::vector<int> order( n );
+    for ( int i = 0;i < n;i ++ ) order[i] = i;
+    std::sort( order.begin(),order.end(),batch_key_less( updates ) );
+
+    // 先取所有元素更新前的排名，此时_list还是有序的
+    std::vector<element_t *> elements( n,(element_t *)NULL );
+    for ( int i = 0;i < n;i ++ )
+    {
+        int index = order[i];
+
+        element_t *element = find_key( updates[index]._key );
+        if ( !element )
         {
-        case ST_FCNT: // 读取排序因子数量
+            old_pos[index] = 0;
+            continue;
+        }
+
+        elements[index] = element;
+        old_pos [index] = position( element );
+    }
+
+    // 限制了最大数量时，新元素可能被丢弃或者挤掉其他元素，只能逐个更新
+    // update_factor会记录变更日志
+    if ( BM_AUTO == mode && _limit > 0 ) mode = BM_SINGLE;
+    if ( BM_SINGLE == mode )
+    {
+        for ( int i = 0;i < n;i ++ )
         {
-            step ++;
-            ifs.read( (char*)&cur_factor,sizeof(cur_factor) );
-            if ( cur_factor < 0 || cur_factor > MAX_FACTOR ) _errno = 6;
-        }break;
-        case ST_ECNT: // 读取元素数量
+            const update_t &update = updates[order[i]];
+            if ( i + 1 < n && updates[order[i + 1]]._key == update._key ) continue;
+
+            int pos = 0;
+            update_factor( update._key,update._factor,update._cnt,pos );
+        }
+
+        for ( int i = 0;i < n;i ++ )
         {
-            ifs.read( (char*)&cur_size,sizeof(cur_size) );
-            if ( cur_size < 0 )
-            {
-                _errno = 7;
-                continue  ;
-            }
+            new_pos[i] = get_position( updates[i]._key );
+        }
 
-            step = cur_size > 0 ? step + 1 : ST_DONE;
-        }break;
-        case ST_EKEY: // 读取key
+        return n;
+    }
+
+    // 新key可能很多，预留索引空间，避免插入时多次扩容
+    _kmap.reserve( _kmap.size() + n );
+
+    std::vector<element_t *> moved;    // 需要调整位置的元素
+    std::vector<const update_t *> src; // moved对应的更新，新元素为NULL
+    std::vector<int> removed;          // 从_list中移出的元素索引
+    std::vector<int> moved_pos;        // moved更新前的排名，新元素为0
+    for ( int i = 0;i < n; )
+    {
+        // 同一个key的更新在order中是相邻的，最后一个生效
+        int j = i;
+        key_t key = updates[order[i]]._key;
+        while ( j + 1 < n && updates[order[j + 1]]._key == key ) j ++;
+
+        const update_t &update = updates[order[j]];
+        element_t *element = elements[order[j]];
+        if ( !element )
         {
-            step  ++;
-            factor_size = 0; // reset factor size for current element
-            ifs.read( (char*)&key,sizeof(key) );
-        }break;
-        case ST_EFCT: // 读取元素排序因子
+            element = new_element( key,update._factor );
+
+            moved.push_back( element );
+            src.push_back( NULL );
+            moved_pos.push_back( 0 );
+        }
+        else if ( 0 != compare( update._factor,element->_factor ) )
         {
-            ifs.read( (char*)(factor + factor_size),sizeof(factor_t) );
+            // BK_ARRAY下_pos已在上面修正过，这时候是准确的
+            removed.push_back( element->_pos - 1 );
 
-            if ( ++factor_size >= cur_factor ) // 所有排序因子都读取完成
+            moved.push_back( element );
+            src.push_back( &update );
+            moved_pos.push_back( old_pos[order[j]] );
+        }
+
+        for ( ;i <= j;i ++ ) elements[order[i]] = element;
+    }
+
+    if ( BM_AUTO == mode )
+    {
+        bool large = (int)moved.size() * BULK_MERGE_RATIO >= _cur_size;
+        mode = BK_ARRAY == _backend && large ? BM_MERGE : BM_SHIFT;
+    }
+
+    if ( BM_MERGE == mode )
+    {
+        // _pos改为处理顺序，向下移动的为负数，合并时据此决定和相同排序因子的
+        // 元素的先后，removed已经取得，不再需要更新前的位置
+        for ( size_t k = 0;k < moved.size();k ++ )
+        {
+            int shift = src[k] ? compare( src[k]->_factor,moved[k]->_factor ) : 1;
+            moved[k]->_pos = shift > 0 ? (int)k + 1 : -(int)k - 1;
+            if ( !src[k] ) continue;
+
+            memcpy( moved[k]->_factor,src[k]->_factor,sizeof(moved[k]->_factor) );
+        }
+
+        if ( BK_TREE == _backend )
+        {
+            tree_merge( moved );
+        }
+        else
+        {
+            merge( moved,removed );
+        }
+    }
+    else
+    {
+        for ( size_t k = 0;k < moved.size();k ++ )
+        {
+            element_t *element = moved[k];
+            if ( !src[k] )
             {
-                step ++;
+                insert( element );
+                continue;
+            }
+
+            position( element ); // 前面的元素移动后_pos可能已过期
+
+            int shift = compare( src[k]->_factor,element->_factor );
+            memcpy( element->_factor,src[k]->_factor,sizeof(element->_factor) );
+            reposition( element,shift );
+        }
+    }
+
+    // 整个批次及方式记录到日志中，重放时按同样的方式更新
+    journal_bulk( updates,n,mode );
+
+    // 多个元素同时移动，排名事件按批量更新前后的排名一次计算
+    std::vector<int> moved_new( moved.size(),0 );
+    if ( tracking() )
+    {
+        for ( size_t k = 0;k < moved.size();k ++ ) moved_new[k] = position( moved[k] );
+    }
+    if ( _watch_cap > 0 ) watch_bulk( moved,moved_pos,moved_new );
+
+    for ( size_t k = 0;k < moved.size();k ++ )
+    {
+        track( moved[k],moved_pos[k],moved_new[k],true );
+    }
+
+    // 只有重放日志时才会超出最大数量，被删除的元素不能再访问
+    bool trim = _limit > 0 && _cur_size > _limit;
+    if ( trim ) set_max_size( _limit );
+
+    for ( int i = 0;i < n;i ++ )
+    {
+        new_pos[i] = trim ? get_position( updates[i]._key ) : position( elements[i] );
+    }
+
+    return n;
+}
+
+/* 打印整个排行榜数据 */
+void lir::raw_dump( std::ostream &os )
+{
+    // print header
+    os << "position";
+    for ( int i = 0;i < _cur_factor;i ++ )
+    {
+        os << '\t' << "factor" << i + 1;
+    }
+
+    os << '\t' << "values ..." << std::endl;
+
+    const element_t *e = seek( 0 );
+    for ( int index = 0;e;e = next( e,index ++ ) )
+    {
+        // print position and key
+        os << index + 1 << '\t' << e->_key;
+
+        // print all factor
+        for ( int findex = 0;findex < _cur_factor;findex ++ )
+        {
+            os << '\t' << e->_factor[findex];
+        }
+
+        // print all value
+        for ( int hindex = 0;hindex < e->_vsz;hindex ++ )
+        {
+            const lval_t &lval = e->_val[hindex];
+            switch ( lval._vt )
+            {
+                case LVT_UNDEF   : os << '\t';break;
+                case LVT_NIL     : os << '\t' << "nil";break;
+                case LVT_BOOLEAN : 
+                    os << "\t" << (lval._v._int ? "true" : "false");break;
+                case LVT_INTEGER : os << '\t' << lval._v._int;break;
+                case LVT_NUMBER  : os << '\t' << lval._v._num;break;
+                case LVT_STRING  : os << '\t' << lval_str( lval );break;
+            }
+        }
+
+        os << std::endl;
+    }
+}
+
+/* 打印到std::cout还是文件 */
+void lir::dump( const char *path )
+{
+    if ( path )
+    {
+        std::ofstream ofs( path,std::ofstream::app );
+        if ( ofs.good() )
+        {
+            raw_dump( ofs );
+            ofs.close    ();
+
+            return;
+        }
+    }
+
+    raw_dump( std::cout );
+}
+
+/*
+ * !!!! @lval should not need to delete mmemory here
+ */
+int lir::update_one_value( key_t key,int index,const lval_t &lval )
+{
+    element_t *element = find_key( key );
+    if ( !element )
+    {
+        return 1;
+    }
+
+    if ( index < 0 || index >= MAX_VALUE ) return 3;
+
+    _modify = true;
+
+    if ( !element->_val )
+    {
+        int sz = DEFAULT_VALUE;
+        while ( sz <= index ) sz *=2;
+
+        element->_vsz = sz;
+        element->_val = new_value( sz );
+    }
+    else if ( element->_vsz <= index )
+    {
+        int sz = element->_vsz;
+        while ( sz <= index ) sz *=2;
+
+        lval_t *val = new_value( sz );
+        memcpy( val,element->_val,sizeof(lval_t)*element->_vsz );
+        del_value( element->_val,element->_vsz );
+
+        element->_vsz = sz;
+        element->_val = val;
+    }
+
+    cpy_lval( *(element->_val + index),lval );// delete old value memory
+    journal_value( key,index,lval );
+    track( element,0,0 );
+
+    return 0;
+}
+
+// 获取排序因子
+int lir::get_factor( key_t key,factor_t **factor )
+{
+    element_t *element = find_key( key );
+    if ( !element ) return    0;
+
+    *factor = element->_factor;
+
+    return _cur_factor;
+}
+
+// 获取变量
+int lir::get_value( key_t key,lval_t **val )
+{
+    element_t *element = find_key( key );
+    if ( !element ) return    0;
+
+    *val = element->_val;
+
+    return element->_vsz;
+}
+
+// 获取变量
+lir::key_t *lir::get_key( int pos )
+{
+    element_t *element = seek( pos );
+    if ( !element ) return NULL;
+
+    return &(element->_key);
+}
+
+// 根据key获取所在排名
+int lir::get_position( const key_t &key )
+{
+    element_t *element = find_key( key );
+    if ( !element ) return    0;
+
+    return position( element );
+}
+
+/* 排序因子比factor好的元素数量，equal为true时包括相同的
+ * 排行是降序的，二分查找第一个比factor差的元素。查询的factor不一定能压缩，
+ * 所以直接对比元素的排序因子而不是_skey
+ */
+int lir::count_better( const factor_t *factor,bool equal )
+{
+    int limit = equal ? 0 : 1;
+    if ( BK_TREE == _backend ) return tree_count( factor,limit );
+
+    int lo = 0;
+    int hi = _cur_size;
+    while ( lo < hi )
+    {
+        int mid = lo + ( hi - lo )/2;
+        if ( compare( _list[mid]->_factor,factor ) >= limit )
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/* 第一个排序因子在[lo,hi]内的元素
+ * 其他排序因子取正、负无穷，两次二分分别找到第一个因子小于等于hi、小于lo的位置
+ */
+int lir::score_range( factor_t lo,factor_t hi,int &from )
+{
+    factor_t upper[MAX_FACTOR];
+    factor_t lower[MAX_FACTOR];
+    for ( int i = 0;i < MAX_FACTOR;i ++ )
+    {
+        upper[i] =  HUGE_VAL;
+        lower[i] = -HUGE_VAL;
+    }
+    upper[0] = hi;
+    lower[0] = lo;
+
+    from = count_better( upper,false );
+    int to = count_better( lower,true );
+
+    return to > from ? to - from : 0;
+}
+
+// 删除一个元素
+int lir::del( const key_t &key )
+{
+    ltimer timer( _stat_on ? &_stat._del : NULL );
+
+    element_t *element = find_key( key );
+    if ( !element )
+    {
+        return 0;
+    }
+
+    _modify = true;
+    journal_del( key );
+
+    int pos = position( element );
+    track_del( key,pos,_cur_size );
+
+    _kmap.erase( key );
+    --_cur_size;
+
+    if ( BK_TREE == _backend )
+    {
+        tree_remove( element->_node );
+        _npool.free( element->_node );
+        del_element( element );
+
+        return pos;
+    }
+
+    // 当前元素后的都往前移动一个位置，它们的_pos在下次position时再修正
+    move( pos - 1,pos,_cur_size - pos + 1 );
+
+    *(_list + _cur_size) = NULL;
+
+    del_element( element );
+
+    return pos;
+}
+
+/* 读取整个文件，文件不存在时返回0 */
+int lir::read_file( const char *path,std::vector<char> &data )
+{
+    int fd = ::open( path,O_RDONLY );
+    if ( fd < 0 ) return ENOENT == errno ? 0 : -1;
+
+    struct stat st;
+    if ( ::fstat( fd,&st ) < 0 )
+    {
+        ::close( fd );
+        return -1;
+    }
+
+    data.resize( st.st_size );
+
+    size_t sz = 0;
+    while ( sz < data.size() )
+    {
+        ssize_t n = ::read( fd,&data[sz],data.size() - sz );
+        if ( n < 0 && EINTR == errno ) continue;
+        if ( n <= 0 ) break;
+
+        sz += n;
+    }
+    data.resize( sz );
+
+    ::close( fd );
+    return 0;
+}
+
+/* 序列化整个排行(不包括文件头)
+ * 排序因子数量、元素数量，然后按排名写入每个元素：
+ * key(zigzag varint)、排序因子(原始字节)、已设置的变量数量，
+ * 每个已设置的变量：下标(varint)、类型(1字节)、值
+ * 字符串为长度(varint)、内容，再加一个'\0'，加载时可以直接使用
+ */
+void lir::serialize( lbuffer &buffer )
+{
+    buffer.reserve( buffer.size() + _cur_size*( 8 + sizeof(factor_t)*_cur_factor ) );
+
+    buffer.append_varint( _cur_factor );
+    buffer.append_varint( _cur_size   );
+
+    const element_t *element = seek( 0 );
+    for ( int i = 0;element;element = next( element,i ++ ) )
+    {
+        buffer.append_zigzag( element->_key );
+        buffer.append( element->_factor,sizeof(factor_t)*_cur_factor );
+
+        serialize_value( buffer,element );
+    }
+}
+
+/* 序列化一个元素已设置的变量 */
+void lir::serialize_value( lbuffer &buffer,const element_t *element )
+{
+    int vcnt = 0;
+    for ( int vindex = 0;vindex < element->_vsz;vindex ++ )
+    {
+        if ( LVT_UNDEF != element->_val[vindex]._vt ) vcnt ++;
+    }
+
+    buffer.append_varint( vcnt );
+    for ( int vindex = 0;vcnt > 0 && vindex < element->_vsz;vindex ++ )
+    {
+        const lval_t &lval = element->_val[vindex];
+        if ( LVT_UNDEF == lval._vt ) continue;
+
+        encode_value( buffer,vindex,lval );
+    }
+}
+
+/* 序列化一个变量：下标(varint)、类型(1字节)、值 */
+void lir::encode_value( lbuffer &buffer,int index,const lval_t &lval )
+{
+    unsigned char vt = lval._vt;
+    buffer.append_varint( index );
+    buffer.append( &vt,sizeof(vt) );
+    switch ( lval._vt )
+    {
+        case LVT_UNDEF   : // fall through
+        case LVT_NIL     : break;
+        case LVT_BOOLEAN : // fall through
+        case LVT_INTEGER : buffer.append_zigzag( lval._v._int );break;
+        case LVT_NUMBER  :
+            buffer.append( &lval._v._num,sizeof(lval._v._num) );break;
+        case LVT_STRING  :
+        {
+            const char *str = lval_str( lval );
+            size_t sz = strlen( str );
+
+            buffer.append_varint( sz );
+            buffer.append( str,sz + 1 );
+        }break;
+    }
+}
+
+/* 读取serialize_value写入的一个变量，返回错误码
+ * 字符串直接引用reader中的数据(LSF_PTR)，不拷贝
+ */
+int lir::decode_value( lreader &reader,int &index,lval_t &lval )
+{
+    uint64_t vindex = 0;
+    unsigned char vt = 0;
+    if ( !reader.read_varint( vindex ) || !reader.read( &vt,sizeof(vt) ) )
+    {
+        return 9;
+    }
+    if ( vindex >= (uint64_t)MAX_VALUE ) return 3;
+
+    index = (int)vindex;
+
+    lval._vt = (lvt_t)vt;
+    lval._sf = LSF_PTR;
+    switch ( vt )
+    {
+        case LVT_UNDEF   : // fall through
+        case LVT_NIL     : break;
+        case LVT_BOOLEAN : // fall through
+        case LVT_INTEGER :
+        {
+            int64_t val = 0;
+            if ( !reader.read_zigzag( val ) ) return 9;
+
+            lval._v._int = val;
+        }break;
+        case LVT_NUMBER  :
+        {
+            if ( !reader.read( &lval._v._num,sizeof(lval._v._num) ) ) return 9;
+        }break;
+        case LVT_STRING  :
+        {
+            uint64_t len = 0;
+            const char *str = NULL;
+            if ( !reader.read_varint( len ) || len >= reader.remain()
+                || !( str = reader.skip( len + 1 ) ) || '\0' != str[len] )
+            {
+                return 10;
+            }
+
+            lval._v._str = const_cast<char *>( str );
+        }break;
+        default : return 9;
+    }
+
+    return 0;
+}
+
+/* 读取一个元素的所有变量，变量数组一次分配到需要的大小 */
+int lir::unserialize_value( lreader &reader,element_t *element )
+{
+    uint64_t vcnt = 0;
+    if ( !reader.read_varint( vcnt ) || vcnt > (uint64_t)MAX_VALUE ) return 8;
+
+    if ( 0 == vcnt ) return 0;
+
+    lval_t vals[MAX_VALUE];
+    int    vidx[MAX_VALUE];
+
+    int sz = DEFAULT_VALUE;
+    for ( uint64_t j = 0;j < vcnt;j ++ )
+    {
+        // 字符串直接引用文件数据，cpy_lval时才拷贝
+        int err = decode_value( reader,vidx[j],vals[j] );
+        if ( err ) return err;
+
+        while ( sz <= vidx[j] ) sz *= 2;
+    }
+
+    element->_vsz = sz;
+    element->_val = new_value( sz );
+    for ( uint64_t j = 0;j < vcnt;j ++ )
+    {
+        cpy_lval( *(element->_val + vidx[j]),vals[j] );
+    }
+
+    return 0;
+}
+
+/* 从serialize的数据中加载，返回错误码
+ * 文件中的元素已按排名排序，校验顺序后直接放到排行中，不需要逐个插入。
+ * 顺序不对(如手动修改了文件)时先排序再放入
+ */
+int lir::unserialize( const char *data,size_t sz )
+{
+    lreader reader( data,sz );
+
+    uint64_t cur_factor = 0;
+    if ( !reader.read_varint( cur_factor ) || cur_factor > (uint64_t)MAX_FACTOR )
+    {
+        return 6;
+    }
+
+    // 每个元素至少占用几个字节，防止非法的数量导致分配过多内存
+    uint64_t cur_size = 0;
+    if ( !reader.read_varint( cur_size ) || cur_size > reader.remain() )
+    {
+        return 7;
+    }
+
+    std::vector<element_t *> elements;
+    elements.reserve( cur_size );
+    _kmap.reserve( cur_size );
+
+    int  err    = 0;
+    bool sorted = true;
+    for ( uint64_t i = 0;0 == err && i < cur_size;i ++ )
+    {
+        int64_t key = 0;
+        factor_t factor[MAX_FACTOR] = { 0 };
+        if ( !reader.read_zigzag( key )
+            || !reader.read( factor,sizeof(factor_t)*cur_factor ) )
+        {
+            err = 12;
+            break;
+        }
+
+        if ( check_factor( factor ) )
+        {
+            err = 14;
+            break;
+        }
+
+        if ( _kmap.find( key ) )
+        {
+            err = 7; // 重复的key
+            break;
+        }
+
+        element_t *element = new_element( key,factor );
+        element->_pos = (int)i + 1; // 文件中的顺序，排序时保证稳定
+        elements.push_back( element );
+
+        if ( i > 0 && compare( elements[i - 1],element ) < 0 ) sorted = false;
+
+        err = unserialize_value( reader,element );
+    }
+
+    if ( 0 == err && 0 != reader.remain() ) err = 12;
+
+    if ( 0 != err )
+    {
+        for ( size_t i = 0;i < elements.size();i ++ )
+        {
+            _kmap.erase( elements[i]->_key );
+            del_element( elements[i] );
+        }
+
+        return err;
+    }
+
+    if ( !sorted )
+    {
+        std::sort( elements.begin(),elements.end(),batch_greater( this ) );
+    }
+
+    // 限制了最大数量时，丢弃排名靠后的
+    int n = (int)elements.size();
+    if ( _limit > 0 && n > _limit )
+    {
+        for ( int i = _limit;i < n;i ++ )
+        {
+            _kmap.erase( elements[i]->_key );
+            del_element( elements[i] );
+        }
+
+        n = _limit;
+    }
+
+    if ( (int)cur_factor > _cur_factor ) _cur_factor = (int)cur_factor;
+
+    _modify   = true;
+    _cur_size = n;
+    if ( 0 == n ) return 0;
+
+    if ( BK_TREE == _backend )
+    {
+        tree_build( &elements[0],n );
+        return 0;
+    }
+
+    reserve( n );
+    for ( int i = 0;i < n;i ++ )
+    {
+        elements[i]->_pos = i + 1;
+        place( i,elements[i] );
+    }
+
+    return 0;
+}
+
+// 保存到文件
+// @f 是否强制保存文件(force)
+int lir::save( int f )
+{
+    if ( !f && !_modify ) return 0; // no need to save
+
+    ltimer timer( _stat_on ? &_stat._save : NULL );
+
+    // 等待后台保存完成，避免同时写同一个文件
+    int err = 0;
+    if ( lsaver::ST_ERROR == _saver.wait( err ) ) _compact = true;
+
+    // 开启了变更日志时，只追加变更
+    if ( !f && journal_append() )
+    {
+        _modify = false;
+        return 1;
+    }
+
+    // 先序列化到一个连续的缓冲区，再一次写入文件
+    _generation ++;
+
+    lbuffer buffer;
+    pack( buffer );
+    seal( &buffer );
+
+    if ( lsaver::write_file( _path,buffer.data(),buffer.size() ) < 0 )
+    {
+        _compact = true;
+        return -1;
+    }
+
+    _base_size = buffer.size();
+    _jpending.clear();
+
+    // 完整文件之后是一个新的空日志
+    _compact = true;
+    if ( _journal_on )
+    {
+        std::string path;
+        lbuffer jbuffer( sizeof(journal_header_t) );
+        journal_header( jbuffer );
+
+        if ( 0 == lsaver::write_file( journal_path( path ),jbuffer.data(),jbuffer.size() ) )
+        {
+            _compact      = false;
+            _journal_size = jbuffer.size();
+        }
+    }
+
+    _modify = false;
+
+    return 1;
+}
+
+/* 后台保存
+ * 在当前线程序列化(即为一份一致的拷贝)，校验、写文件、fsync在工作线程中完成
+ * 返回0表示不需要保存，-1表示出错(上一次后台保存未完成时errno为EBUSY)
+ */
+int lir::save_async( int f )
+{
+    if ( !f && !_modify ) return 0; // no need to save
+
+    if ( _saver.running() )
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    // 开启了变更日志时，只追加变更，数据量小，不需要后台保存
+    if ( !f && journal_append() )
+    {
+        _modify = false;
+        return 1;
+    }
+
+    _generation ++;
+
+    lbuffer *buffer = new lbuffer( _cur_size*( 16 + sizeof(factor_t)*_cur_factor ) );
+    pack( *buffer );
+
+    size_t base_size = buffer->size();
+    _saver.add( _path,buffer,seal );
+
+    // 完整文件写入成功后才写入新的空日志
+    if ( _journal_on )
+    {
+        std::string path;
+        lbuffer *jbuffer = new lbuffer( sizeof(journal_header_t) );
+        journal_header( *jbuffer );
+
+        _saver.add( journal_path( path ),jbuffer );
+    }
+
+    if ( _saver.start() < 0 )
+    {
+        _compact = true;
+        return -1;
+    }
+
+    // 之后的变更记录到新的日志中，保存失败时(save_status)再写完整文件
+    _base_size    = base_size;
+    _journal_size = sizeof(journal_header_t);
+    _compact      = !_journal_on;
+    _jpending.clear();
+
+    _modify = false;
+
+    return 1;
+}
+
+/* 后台保存的状态，见lsaver::status_t。保存失败时重新标记为已修改 */
+int lir::save_status( int &err )
+{
+    int status = _saver.status( err );
+    if ( lsaver::ST_ERROR == status )
+    {
+        _modify  = true;
+        _compact = true;
+    }
+
+    return status;
+}
+
+/* 写入文件头及序列化数据，文件头的其他字段在seal中填充 */
+void lir::pack( lbuffer &buffer )
+{
+    file_header_t header;
+    memset( &header,0,sizeof(header) );
+    header._generation = _generation;
+
+    buffer.append( &header,sizeof(header) );
+    buffer.append( &_decay_base,sizeof(_decay_base) );
+    serialize( buffer );
+}
+
+/* 填充文件头，计算校验值 */
+void lir::seal( lbuffer *buffer )
+{
+    file_header_t header;
+    memcpy( &header,buffer->data(),sizeof(header) );
+
+    header._magic   = FILE_MAGIC;
+    header._version = FILE_VERSION;
+    header._size    = buffer->size() - sizeof(header);
+    header._crc     = lcrc32( buffer->data() + sizeof(header),header._size );
+    buffer->overwrite( 0,&header,sizeof(header) );
+}
+
+static bool snapshot_index_less( const lsnapshot::index_t &a,const lsnapshot::index_t &b )
+{
+    return a._key < b._key;
+}
+
+/* 生成只读快照数据，格式见lsnapshot.hpp */
+void lir::snapshot( lbuffer &buffer )
+{
+    size_t stride = sizeof(key_t) + sizeof(factor_t)*_cur_factor;
+
+    lsnapshot::header_t header;
+    memset( &header,0,sizeof(header) );
+    header._magic   = lsnapshot::MAGIC;
+    header._version = lsnapshot::VERSION;
+    header._factor  = _cur_factor;
+    header._size    = _cur_size;
+    header._rank    = sizeof(header);
+    header._index   = header._rank  + stride*_cur_size;
+    header._voff    = header._index + sizeof(lsnapshot::index_t)*_cur_size;
+    header._value   = header._voff  + sizeof(uint64_t)*( _cur_size + 1 );
+
+    buffer.clear();
+    buffer.reserve( header._value );
+    buffer.append( &header,sizeof(header) );
+
+    lbuffer value;
+    std::vector<uint64_t> voff;
+    std::vector<lsnapshot::index_t> index;
+    voff.reserve ( _cur_size + 1 );
+    index.reserve( _cur_size );
+
+    // 衰减模式下快照中是生成时的值
+    double scale = _decay_index >= 0
+        ? std::pow( 2.0,( _decay_base - decay_now() )/_half_life ) : 1.0;
+
+    const element_t *element = seek( 0 );
+    for ( int i = 0;element;element = next( element,i ++ ) )
+    {
+        factor_t factor[MAX_FACTOR];
+        memcpy( factor,element->_factor,sizeof(factor) );
+        if ( _decay_index >= 0 ) factor[_decay_index] *= scale;
+
+        buffer.append( &(element->_key),sizeof(key_t) );
+        buffer.append( factor,sizeof(factor_t)*_cur_factor );
+
+        lsnapshot::index_t idx;
+        idx._key = element->_key;
+        idx._pos = i + 1;
+        index.push_back( idx );
+
+        voff.push_back( value.size() );
+        serialize_value( value,element );
+    }
+    voff.push_back( value.size() );
+
+    std::sort( index.begin(),index.end(),snapshot_index_less );
+    if ( !index.empty() )
+    {
+        buffer.append( &index[0],sizeof(lsnapshot::index_t)*index.size() );
+    }
+    buffer.append( &voff[0],sizeof(uint64_t)*voff.size() );
+    buffer.append( value.data(),value.size() );
+
+    header._end = buffer.size();
+    buffer.overwrite( 0,&header,sizeof(header) );
+}
+
+/* 保存只读快照 */
+int lir::save_snapshot( const char *path )
+{
+    lbuffer buffer;
+    snapshot( buffer );
+
+    return lsaver::write_file( path,buffer.data(),buffer.size() );
+}
+
+/* 开始新的周期(如每日、每周排行)
+ * 排行数组、树、索引、内存池、字符串常量池整个交换到新的排行对象中，不需要
+ * 逐个删除元素。旧周期的排行保留排序因子数量、压缩等设置，不记录变更日志，
+ * 路径为空，不会覆盖当前排行的文件
+ */
+lir *lir::rollover()
+{
+    lir *old = new lir( "",_backend );
+
+    // 之前的事件仍然留在缓冲区中，之后是阈值内的元素离开的事件
+    if ( _watch_cap > 0 ) watch_clear();
+
+    std::swap( _list,old->_list );
+    std::swap( _skey,old->_skey );
+    std::swap( _max_size,old->_max_size );
+    std::swap( _cur_size,old->_cur_size );
+    std::swap( _root,old->_root );
+
+    _kmap.swap( old->_kmap );
+    _intern.swap( old->_intern );
+    _epool.swap( old->_epool );
+    _npool.swap( old->_npool );
+    for ( int i = 0;i < VALUE_POOL;i ++ ) std::swap( _vpool[i],old->_vpool[i] );
+
+    old->_cur_factor = _cur_factor;
+    old->_packed     = _packed;
+    old->_intern_on  = _intern_on;
+    old->_limit      = _limit;
+
+    old->_decay_index = _decay_index;
+    old->_half_life   = _half_life;
+    old->_decay_base  = _decay_base;
+    old->_decay_clock = _decay_clock;
+    memcpy( old->_pbits,_pbits,sizeof(_pbits) );
+
+    // 文件、日志需要重新写完整的空排行
+    _modify  = true;
+    _compact = true;
+
+    // 无法用变更描述清空，之前的序号都不能再获取变更
+    _seq ++;
+    _track_min = _seq;
+    _changes.clear();
+
+    return old;
+}
+
+// 从文件加载数据，再重放变更日志
+int lir::load()
+{
+    if ( 0 != _cur_size ) return 13;
+
+    ltimer timer( _stat_on ? &_stat._load : NULL );
+
+    // 加载过程中的更新不需要记录日志
+    bool journal_on = _journal_on;
+    _journal_on = false;
+
+    int err = load_file();
+    if ( 0 == err ) err = journal_replay();
+
+    _journal_on = journal_on;
+
+    return err;
+}
+
+// 加载完整文件，自动识别文件格式
+int lir::load_file()
+{
+    _generation = 0;
+    _base_size  = 0;
+
+    std::vector<char> data;
+    if ( read_file( _path,data ) < 0 ) return 12;
+
+    if ( data.empty() ) return 0;
+
+    file_header_t header;
+    if ( data.size() < sizeof(header) ) return load_v1();
+
+    memcpy( &header,&data[0],sizeof(header) );
+    if ( FILE_MAGIC != header._magic ) return load_v1();
+
+    if ( FILE_VERSION != header._version && 2 != header._version ) return 18;
+    if ( header._size != data.size() - sizeof(header) ) return 12;
+
+    const char *body = &data[0] + sizeof(header);
+    if ( header._crc != lcrc32( body,header._size ) ) return 17;
+
+    _generation = header._generation;
+    _base_size  = data.size();
+
+    // 版本2没有衰减的基准时间，存储的值即为当前的值
+    size_t sz = header._size;
+    double base = 0;
+    if ( header._version >= 3 )
+    {
+        if ( sz < sizeof(base) ) return 12;
+
+        memcpy( &base,body,sizeof(base) );
+        body += sizeof(base);
+        sz   -= sizeof(base);
+    }
+    if ( _decay_index >= 0 && base > 0 ) _decay_base = base;
+
+    return unserialize( body,sz );
+}
+
+/* 加载旧版本(没有文件头)的文件 */
+int lir::load_v1()
+{
+    enum step
+    {
+        ST_FCNT = 0,  // 读取排序因子数量
+        ST_ECNT    ,  // 读取元素数量
+        ST_EKEY    ,  // element key
+        ST_EFCT    ,  // element factor
+        ST_EVSZ    ,  // element value size
+        ST_EVAL    ,  // element value
+        ST_FCHK    ,  // finish check
+        ST_DONE       // 完成
+    };
+
+    std::ifstream ifs( _path,std::ifstream::in );
+    if ( !ifs.good() || ifs.peek() == std::ifstream::traits_type::eof() )
+    {
+        return 0;
+    }
+
+    int step = ST_FCNT;
+    int cur_size   = 0;
+    int read_size  = 0; // 已读取的元素数量，限制了最大数量时不等于_cur_size
+
+    key_t key;
+
+    int cur_factor  = 0;
+    int factor_size = 0;
+    factor_t factor[MAX_FACTOR] = { 0 };
+
+    int vsz = 0;
+    int cur_vsz = 0;
+
+    // 字符串变量只是借用这个缓冲区，update_one_value时才拷贝
+    static const int max = 256;
+    char buffer[max];
+
+    int _errno = 0;
+
+    while( ifs.good() && 0 == _errno )
+    {
+        switch( step )
+        {
+        case ST_FCNT: // 读取排序因子数量
+        {
+            step ++;
+            ifs.read( (char*)&cur_factor,sizeof(cur_factor) );
+            if ( cur_factor < 0 || cur_factor > MAX_FACTOR ) _errno = 6;
+        }break;
+        case ST_ECNT: // 读取元素数量
+        {
+            ifs.read( (char*)&cur_size,sizeof(cur_size) );
+            if ( cur_size < 0 )
+            {
+                _errno = 7;
+                continue  ;
+            }
+
+            step = cur_size > 0 ? step + 1 : ST_DONE;
+        }break;
+        case ST_EKEY: // 读取key
+        {
+            step  ++;
+            factor_size = 0; // reset factor size for current element
+            ifs.read( (char*)&key,sizeof(key) );
+        }break;
+        case ST_EFCT: // 读取元素排序因子
+        {
+            ifs.read( (char*)(factor + factor_size),sizeof(factor_t) );
+
+            if ( ++factor_size >= cur_factor ) // 所有排序因子都读取完成
+            {
+                step ++;
+
+                if ( check_factor( factor ) )
+                {
+                    _errno = 14;
+                    continue   ;
+                }
+
+                int old_pos = 0;
+                update_factor( key,factor,factor_size,old_pos );
+            }
+        }break;
+        case ST_EVSZ: // 读取元素变量数量
+        {
+            cur_vsz = 0; // reset value size for current element
+            ifs.read( (char*)&vsz,sizeof(vsz) );
+
+            if ( vsz < 0 ) _errno = 8;
+
+            step = vsz > 0 ? ST_EVAL : ST_FCHK;
+        }break;
+        case ST_EVAL: // 读取变量值
+        {
+            lval_t lval;
+            lval._sf = LSF_PTR;
+            ifs.read( (char*)&lval._vt,sizeof(lval._vt) );
+            if ( !ifs.good() )
+            {
+                _errno = 9;
+                continue  ;
+            }
+
+            switch( lval._vt )
+            {
+                case LVT_UNDEF   :
+                case LVT_NIL     : break;
+                case LVT_BOOLEAN : 
+                case LVT_INTEGER : 
+                    ifs.read( (char*)&lval._v._int,sizeof(lval._v._int) );break;
+                case LVT_NUMBER  :
+                    ifs.read( (char*)&lval._v._num,sizeof(lval._v._num) );break;
+                case LVT_STRING  :
+                {
+                    int sz = read_string( ifs,buffer,max );
+                    if ( sz < 0 )
+                    {
+                        _errno = 10;
+                        continue   ;
+                    }
+
+                    lval._v._str = buffer;//not new_string( buffer,sz );
+                }break;
+            }
+
+            // 超出最大数量被丢弃的元素，忽略其变量
+            int err = update_one_value( key,cur_vsz,lval );
+            if ( err && 1 != err )
+            {
+                _errno = 11;
+                continue   ;
+            }
+
+            // 检查当前元素的变量是否读取完成
+            if ( ++cur_vsz >= vsz ) step ++;
+        }break;
+        case ST_FCHK: // 检查是否还有下一个元素
+        {
+            step = ++read_size >= cur_size ? ST_DONE : ST_EKEY;
+        }break;
+        case ST_DONE:
+        {
+            ifs.close();
+            return    0;
+        }break;
+        // end of switch
+        }
+    }
+
+    if ( !ifs.good() && ST_DONE != step ) _errno = 12;
+
+    ifs.close()  ;
+    return _errno;   
+}
+
+/* 开启或关闭字符串常量池，已保存的字符串不受影响 */
+void lir::set_intern( bool on )
+{
+    _intern_on = on;
+}
+
+/* 开启或关闭运行统计，关闭时只需要判断一次开关 */
+void lir::set_stats( bool on )
+{
+    _stat_on = on;
+}
+
+void lir::reset_stats()
+{
+    _stat._compare = 0;
+    _stat._lookup  = 0;
+    _stat._alloc   = 0;
+    _stat._update.reset();
+    _stat._bulk.reset();
+    _stat._del.reset();
+    _stat._moved.reset();
+    _stat._save.reset();
+    _stat._load.reset();
+}
+
+size_t lir::chunk_count()
+{
+    size_t cnt = _epool.chunk_count() + _npool.chunk_count();
+    for ( int i = 0;i < VALUE_POOL;i ++ ) cnt += _vpool[i]->chunk_count();
+
+    return cnt;
+}
+
+/* ====================LUA STATIC FUNCTION======================= */
+/* 设置玩家的排序因子
+ * self:set_factor( key_id,factor1,factor2,... )
+ */
+static int set_factor( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    lir::key_t key = luaL_checkinteger( L,2 );
+
+    lir::factor_t factor[lir::MAX_FACTOR] = { 0 };
+    
+    int factor_cnt = 0;
+    int top = lua_gettop( L );
+
+    /* 可以一次性传入多个factor，但不能超过MAX_FACTOR */
+    if ( top - 2 > lir::MAX_FACTOR )
+    {
+        return luaL_error( L, 
+            "too many ranking factor,%d at most",lir::MAX_FACTOR );
+    }
+
+    // factor只能是number(integer)类型
+    for ( int i = 3;i <= top;i ++ )
+    {
+        factor[factor_cnt++] = luaL_checknumber( L,i );
+    }
+
+    // 至少需要传入一个factor，其他可以默认为0
+    if ( factor_cnt <= 0 )
+    {
+        return luaL_error( L, "no ranking factor specify" );
+    }
+
+    int err = (*_lir)->check_factor( factor );
+    if ( err ) raise_error( L,err );
+
+    (*_lir)->decay_in( factor );
+
+    int old_pos = 0;
+    int new_pos = (*_lir)->update_factor( key,factor,factor_cnt,old_pos );
+
+    lua_pushinteger( L,new_pos );
+    lua_pushinteger( L,old_pos );
+    return 2;
+}
+
+/* 设置玩家单个排序因子
+ * self:set_factor( key_id,factor1,factor2,... )
+ */
+static int set_one_factor( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    lir::key_t key = luaL_checkinteger( L,2 );
+    lir::factor_t factor = luaL_checknumber( L,3 );
+    lua_Integer index = luaL_checkinteger( L,4 );
+
+    if ( index < 1 )
+    {
+        return luaL_error( L,
+            "index must be in [1,%d]",lir::MAX_FACTOR );
+    }
+    if ( index > lir::MAX_FACTOR )
+    {
+        return luaL_error( L,
+            "too many ranking factor,%d at most",lir::MAX_FACTOR );
+    }
+
+    int err = (*_lir)->check_factor( index - 1,factor );
+    if ( err ) raise_error( L,err );
+
+    factor = (*_lir)->decay_in( factor,index - 1 );
+
+    int old_pos = 0;
+    int new_pos = (*_lir)->update_one_factor( key,factor,index,old_pos );
+
+    lua_pushinteger( L,new_pos );
+    lua_pushinteger( L,old_pos );
+    return 2;
+}
+
+/* 批量设置排序因子
+ * local new_pos,old_pos = self:set_factors_bulk( { {key_id,factor1,factor2,...},... } )
+ * 返回的new_pos、old_pos是数组，和传入的更新一一对应
+ */
+/* 解析批量更新的参数{ {key,factor1,factor2,...},... }，不检查排序因子的范围
+ * 用userdata作为临时内存(留在栈上)，出错时不会内存泄漏，updates后面为n个
+ * new_pos和n个old_pos
+ */
+static lir::update_t *lua_toupdates( lua_State *L,int index,int &n )
+{
+    luaL_checktype( L,index,LUA_TTABLE );
+    n = (int)lua_rawlen( L,index );
+
+    size_t sz = ( sizeof(lir::update_t) + sizeof(int)*2 )*( n > 0 ? n : 1 );
+    lir::update_t *updates = (lir::update_t *)lua_newuserdata( L,sz );
+
+    for ( int i = 0;i < n;i ++ )
+    {
+        if ( LUA_TTABLE != lua_rawgeti( L,index,i + 1 ) )
+        {
+            luaL_error( L,"update #%d expect table",i + 1 );
+        }
+
+        int cnt = (int)lua_rawlen( L,-1 ) - 1;
+        if ( cnt <= 0 || cnt > lir::MAX_FACTOR )
+        {
+            luaL_error( L,
+                "update #%d factor count illegal,%d at most",i + 1,lir::MAX_FACTOR );
+        }
+
+        lir::update_t &update = updates[i];
+        memset( &update,0,sizeof(update) );
+
+        lua_rawgeti( L,-1,1 );
+        if ( !lua_isinteger( L,-1 ) )
+        {
+            luaL_error( L,"update #%d key expect integer",i + 1 );
+        }
+        update._key = lua_tointeger( L,-1 );
+        update._cnt = cnt;
+        lua_pop( L,1 );
+
+        for ( int findex = 0;findex < cnt;findex ++ )
+        {
+            lua_rawgeti( L,-1,findex + 2 );
+            if ( !lua_isnumber( L,-1 ) )
+            {
+                luaL_error( L,"update #%d factor #%d expect number",
+                    i + 1,findex + 1 );
+            }
+            update._factor[findex] = lua_tonumber( L,-1 );
+            lua_pop( L,1 );
+        }
+
+        lua_pop( L,1 );
+    }
+
+    return updates;
+}
+
+/* 把批量更新后的new_pos、old_pos作为两个数组压栈 */
+static int lua_pushbulk( lua_State *L,const int *new_pos,const int *old_pos,int n )
+{
+    lua_createtable( L,n,0 );
+    for ( int i = 0;i < n;i ++ )
+    {
+        lua_pushinteger( L,new_pos[i] );
+        lua_rawseti( L,-2,i + 1 );
+    }
+
+    lua_createtable( L,n,0 );
+    for ( int i = 0;i < n;i ++ )
+    {
+        lua_pushinteger( L,old_pos[i] );
+        lua_rawseti( L,-2,i + 1 );
+    }
+
+    return 2;
+}
+
+static int set_factors_bulk( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    int n = 0;
+    lir::update_t *updates = lua_toupdates( L,2,n );
+    int *new_pos = (int *)( updates + n );
+    int *old_pos = new_pos + n;
+
+    for ( int i = 0;i < n;i ++ )
+    {
+        int err = (*_lir)->check_factor( updates[i]._factor );
+        if ( err ) raise_error( L,err );
+    }
+
+    for ( int i = 0;i < n;i ++ ) (*_lir)->decay_in( updates[i]._factor );
+
+    (*_lir)->update_factors( updates,n,new_pos,old_pos );
+
+    return lua_pushbulk( L,new_pos,old_pos,n );
+}
+
+/* 设置压缩排序因子，只能在排行为空时设置
+ * self:set_packed( bits1,bits2,... )
+ */
+static int set_packed( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    int bits[lir::MAX_FACTOR] = { 0 };
+
+    int top = lua_gettop( L );
+    if ( top - 1 > lir::MAX_FACTOR )
+    {
+        return luaL_error( L,
+            "too many ranking factor,%d at most",lir::MAX_FACTOR );
+    }
+
+    for ( int i = 2;i <= top;i ++ )
+    {
+        bits[i - 2] = luaL_checkinteger( L,i );
+    }
+
+    int err = (*_lir)->set_packed( bits,top - 1 );
+    if ( err ) raise_error( L,err );
+
+    return 0;
+}
+
+/* 开启衰减模式，第index(默认为1)个排序因子每经过half_life秒减半
+ * self:set_decay( half_life[,index] )
+ */
+static int set_decay( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    double half_life = luaL_checknumber( L,2 );
+    int index = (int)luaL_optinteger( L,3,1 );
+
+    int err = (*_lir)->set_decay( half_life,index );
+    if ( err ) raise_error( L,err );
+
+    return 0;
+}
+
+/* 设置衰减模式的当前时间(秒)，不设置或者为0时使用系统时间 */
+static int set_time( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    (*_lir)->set_time( luaL_optnumber( L,2,0 ) );
+
+    return 0;
+}
+
+/* 开启字符串常量池，相同的长字符串变量只保存一份
+ * self:set_intern( true )
+ */
+static int set_intern( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    (*_lir)->set_intern( lua_toboolean( L,2 ) );
+
+    return 0;
+}
+
+/* 记录最近capacity个变更，用于changes_since。0表示不记录 */
+static int set_track( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    int capacity = luaL_checkinteger( L,2 );
+    if ( capacity < 0 )
+    {
+        return luaL_error( L, "capacity illegal" );
+    }
+
+    (*_lir)->set_track( capacity );
+
+    return 0;
+}
+
+/* 当前变更序号 */
+static int get_seq( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    lua_pushinteger( L,(*_lir)->get_seq() );
+
+    return 1;
+}
+
+/* 获取seq之后的变更
+ * 返回t.seq当前序号，t.keys排序因子或者变量变化的key(包括新增的)，
+ * t.deleted被删除的key，t.from、t.to排名发生变化的范围(没有则为nil)
+ * seq太旧(变更已被丢弃)时，t.full为true，需要全量同步
+ */
+static int changes_since( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    int64_t seq = luaL_checkinteger( L,2 );
+
+    int from = 0;
+    int to   = 0;
+    std::vector<lir::key_t> keys;
+    std::vector<lir::key_t> deleted;
+    bool ok = (*_lir)->changes_since( seq,keys,deleted,from,to );
+
+    lua_createtable( L,0,6 );
+
+    lua_pushinteger( L,(*_lir)->get_seq() );
+    lua_setfield( L,-2,"seq" );
+
+    if ( !ok )
+    {
+        lua_pushboolean( L,1 );
+        lua_setfield( L,-2,"full" );
+        return 1;
+    }
+
+    lua_createtable( L,(int)keys.size(),0 );
+    for ( size_t i = 0;i < keys.size();i ++ )
+    {
+        lua_pushinteger( L,keys[i] );
+        lua_rawseti( L,-2,i + 1 );
+    }
+    lua_setfield( L,-2,"keys" );
+
+    lua_createtable( L,(int)deleted.size(),0 );
+    for ( size_t i = 0;i < deleted.size();i ++ )
+    {
+        lua_pushinteger( L,deleted[i] );
+        lua_rawseti( L,-2,i + 1 );
+    }
+    lua_setfield( L,-2,"deleted" );
+
+    if ( from > 0 )
+    {
+        lua_pushinteger( L,from );
+        lua_setfield( L,-2,"from" );
+
+        lua_pushinteger( L,to );
+        lua_setfield( L,-2,"to" );
+    }
+
+    return 1;
+}
+
+/* 开启排名事件，最多缓存capacity个事件，0表示关闭
+ * 之后的参数为监听的排名阈值，如lir:set_watch( 1024,1,10,100 )
+ */
+static int set_watch( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    int capacity = luaL_checkinteger( L,2 );
+    if ( capacity < 0 )
+    {
+        return luaL_error( L, "capacity illegal" );
+    }
+
+    int thresholds[lir::MAX_THRESHOLD];
+    int cnt = lua_gettop( L ) - 2;
+    if ( cnt > lir::MAX_THRESHOLD )
+    {
+        return luaL_error( L, "too many threshold,%d max",lir::MAX_THRESHOLD );
+    }
+
+    for ( int i = 0;i < cnt;i ++ )
+    {
+        thresholds[i] = luaL_checkinteger( L,i + 3 );
+        if ( thresholds[i] <= 0 )
+        {
+            return luaL_error( L, "threshold illegal" );
+        }
+    }
+
+    (*_lir)->set_watch( capacity,thresholds,cnt );
+
+    return 0;
+}
+
+/* 取出最多max个排名事件，不指定则取出全部
+ * 返回事件数组及缓存满时丢弃的事件数量，每个事件为
+ * { type = "move"|"enter"|"leave",key,other,from,to,rank }
+ */
+static int get_events( lua_State *L )
+{
+    static const char *event_name[] = { "none","move","enter","leave" };
+
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    int max = luaL_optinteger( L,2,0 );
+
+    int64_t dropped = 0;
+    std::vector<lir::event_t> events;
+    int cnt = (*_lir)->get_events( events,max,dropped );
+
+    lua_createtable( L,cnt,0 );
+    for ( int i = 0;i < cnt;i ++ )
+    {
+        const lir::event_t &ev = events[i];
+
+        lua_createtable( L,0,6 );
+        lua_pushstring( L,event_name[ev._type] );
+        lua_setfield( L,-2,"type" );
+        lua_pushinteger( L,ev._key );
+        lua_setfield( L,-2,"key" );
+        if ( ev._other )
+        {
+            lua_pushinteger( L,ev._other );
+            lua_setfield( L,-2,"other" );
+        }
+        lua_pushinteger( L,ev._from );
+        lua_setfield( L,-2,"from" );
+        lua_pushinteger( L,ev._to );
+        lua_setfield( L,-2,"to" );
+        if ( ev._rank )
+        {
+            lua_pushinteger( L,ev._rank );
+            lua_setfield( L,-2,"rank" );
+        }
+
+        lua_rawseti( L,-2,i + 1 );
+    }
+    lua_pushinteger( L,dropped );
+
+    return 2;
+}
+
+/* 开启或关闭运行统计 */
+static int set_stats( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    (*_lir)->set_stats( lua_toboolean( L,2 ) );
+
+    return 0;
+}
+
+/* 把直方图转换为table，设置到栈顶table的name字段 */
+static void lua_sethistogram( lua_State *L,const char *name,const lhistogram &h )
+{
+    lua_createtable( L,0,8 );
+
+    lua_pushinteger( L,h.count() );
+    lua_setfield( L,-2,"count" );
+    lua_pushinteger( L,h.min() );
+    lua_setfield( L,-2,"min" );
+    lua_pushinteger( L,h.max() );
+    lua_setfield( L,-2,"max" );
+    lua_pushnumber( L,h.mean() );
+    lua_setfield( L,-2,"mean" );
+    lua_pushinteger( L,h.percentile( 50 ) );
+    lua_setfield( L,-2,"p50" );
+    lua_pushinteger( L,h.percentile( 90 ) );
+    lua_setfield( L,-2,"p90" );
+    lua_pushinteger( L,h.percentile( 99 ) );
+    lua_setfield( L,-2,"p99" );
+    lua_pushinteger( L,h.percentile( 99.9 ) );
+    lua_setfield( L,-2,"p999" );
+
+    lua_setfield( L,-2,name );
+}
+
+/* 获取运行统计，reset为true时获取后清空
+ * 耗时的单位为纳秒，moved为每次更新、删除排名变化的距离
+ */
+static int stats( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    const lir::stat_t &stat = (*_lir)->get_stats();
+
+    lua_createtable( L,0,10 );
+
+    lua_pushinteger( L,stat._compare );
+    lua_setfield( L,-2,"compare" );
+    lua_pushinteger( L,stat._lookup );
+    lua_setfield( L,-2,"lookup" );
+    lua_pushinteger( L,stat._alloc );
+    lua_setfield( L,-2,"alloc" );
+    lua_pushinteger( L,(*_lir)->chunk_count() );
+    lua_setfield( L,-2,"chunk" );
+
+    lua_sethistogram( L,"update",stat._update );
+    lua_sethistogram( L,"bulk",stat._bulk );
+    lua_sethistogram( L,"del",stat._del );
+    lua_sethistogram( L,"moved",stat._moved );
+    lua_sethistogram( L,"save",stat._save );
+    lua_sethistogram( L,"load",stat._load );
+
+    if ( lua_toboolean( L,2 ) ) (*_lir)->reset_stats();
+
+    return 1;
+}
+
+/* 开启变更日志，save时只追加变更，日志过大时才写完整文件 */
+static int set_journal( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    (*_lir)->set_journal( lua_toboolean( L,2 ) );
+
+    return 0;
+}
+
+/* 设置排行最大数量，0表示不限制
+ * 排行已满时，不比最后一名大的新元素直接丢弃，超出的元素立即删除
+ */
+static int set_max_size( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    int max_size = luaL_checkinteger( L,2 );
+    if ( max_size < 0 )
+    {
+        return luaL_error( L, "max size illegal" );
+    }
+
+    (*_lir)->set_max_size( max_size );
+
+    return 0;
+}
+
+/* 打印整个排行榜 */
+static int dump( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    const char *path = luaL_optstring( L,2,NULL );
+
+    (*_lir)->dump( path );
+    return 0;
+}
+
+/* 获取当前排行榜数量 */
+static int size( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    lua_pushinteger( L,(*_lir)->size() );
+
+    return 1;
+}
+
+/* 设置变量值 */
+static int set_value( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    lir::key_t key   = luaL_checkinteger( L,2 );
+    
+    int top = lua_gettop( L );
+    for ( int i = 3;i <= top;i ++ )
+    {
+        // !!!! this lval DO NOT need to delete and CAN ONT
+        const lir::lval_t lval = lua_toelement( L,i );
+        if ( lir::LVT_UNDEF == lval._vt )
+        {
+            return luaL_error( L,
+                "unsouport value type %s",lua_typename(L, lua_type(L, i)) );
+        }
+
+        int err = (*_lir)->update_one_value( key,i - 3,lval );
+
+        if ( err ) raise_error( L,err );
+    }
+
+    return 0;
+}
+
+/* 设置单个变量值 */
+static int set_one_value( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    lir::key_t key   = luaL_checkinteger( L,2 );
+
+    // !!!! this lval DO NOT need to delete and CAN ONT
+    const lir::lval_t lval = lua_toelement( L,3 );
+    if ( lir::LVT_UNDEF == lval._vt )
+    {
+        return luaL_error( L,
+            "unsouport value type %s",lua_typename(L, lua_type(L, 3)) );
+    }
+    int index        = luaL_checkinteger( L,4 );
+
+    int err = (*_lir)->update_one_value( key,index - 1,lval );
+    if ( err )
+    {
+        raise_error( L,err );
+    }
+
+    return 0;
+}
+
+/* 获取排序因子 */
+static int get_factor( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    lir::key_t key   = luaL_checkinteger( L,2 );
+
+    int index = 0;
+    if ( !lua_isnoneornil( L,3 ) )
+    {
+        index = luaL_checkinteger  ( L,3 );
+        if ( index <= 0 || index > lir::MAX_VALUE )
+        {
+            return luaL_error( L, "argument #3 illegal" );
+        }
+    }
+
+    lir::factor_t *factor = NULL;
+    int factor_cnt = (*_lir)->get_factor( key,&factor );
+    assert( factor_cnt >= 0 && factor_cnt <= lir::MAX_FACTOR );
+
+    // get one factor
+    if ( index > 0 )
+    {
+        if ( index >= factor_cnt ) return 0;
+
+        lua_pushintegerornumber( L,(*_lir)->decay_out( *(factor + index - 1),index - 1 ) );
+        return 1;
+    }
+
+    if ( !lua_checkstack( L,factor_cnt ) )
+    {
+        return luaL_error( L,"stack overflow" );
+    }
+
+    for ( int i = 0;i < factor_cnt;i ++ )
+    {
+        lua_pushintegerornumber( L,(*_lir)->decay_out( *(factor + i),i ) );
+    }
+
+    return factor_cnt;
+}
+
+/* 获取排序变量 */
+static int get_value( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    lir::key_t key   = luaL_checkinteger( L,2 );
+
+    int index = 0;
+    if ( !lua_isnoneornil( L,3 ) )
+    {
+        index = luaL_checkinteger  ( L,3 );
+        if ( index <= 0 || index > lir::MAX_VALUE )
+        {
+            return luaL_error( L, "argument #3 illegal" );
+        }
+    }
+
+    lir::lval_t *val = NULL;
+    int val_cnt = (*_lir)->get_value( key,&val );
+    assert( val_cnt >= 0 );
+
+    // get one element
+    if ( index > 0 )
+    {
+        if ( index >= val_cnt ) return 0;
+
+        lua_pushelement( L,*(val + index - 1) );
+        return 1;
+    }
+
+    if ( !lua_checkstack( L,val_cnt ) )
+    {
+        return luaL_error( L,"stack overflow" );
+    }
+
+    // get all element
+    for ( int i = 0;i < val_cnt;i ++ )
+    {
+        lua_pushelement( L,*(val + i) );
+    }
+
+    return val_cnt;
+}
+
+/* 根据排名获取唯一key */
+static int get_position( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    lir::key_t key = luaL_checkinteger( L,2 );
+
+    lua_pushinteger( L,(*_lir)->get_position( key ) );
+
+    return 1;
+}
+
+/* 根据唯一key获取排名 */
+static int get_key( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    int pos = lua_tointeger( L,2 );
+    if ( pos <= 0 )
+    {
+        return luaL_error( L,"illegal rank position" );
+    }
+
+    lir::key_t *key = (*_lir)->get_key( pos - 1 );
+
+    if ( !key ) return 0;
+
+    lua_pushinteger( L,*key );
+    return                  1;
+}
+
+/* 取t[name]，不存在则创建一个新的table。t是栈顶的table，新的table压到栈顶 */
+static void lua_subtable( lua_State *L,const char *name,int narr )
+{
+    if ( LUA_TTABLE == lua_getfield( L,-1,name ) ) return;
+
+    lua_pop( L,1 );
+    lua_createtable( L,narr,0 );
+    lua_pushvalue( L,-1 );
+    lua_setfield( L,-3,name );
+}
+
+/* 栈顶的数组只保留前n个元素，后面的设置为nil */
+static void lua_truncate( lua_State *L,int n )
+{
+    for ( int i = n + 1;LUA_TNIL != lua_rawgeti( L,-1,i );i ++ )
+    {
+        lua_pop( L,1 );
+        lua_pushnil( L );
+        lua_rawseti( L,-2,i );
+    }
+
+    lua_pop( L,1 );
+}
+
+/* 把排名[from,from + n)的数据填充到栈顶的table，from从0开始
+ * @fields 'k'填充key数组，'f'填充排序因子数组(每个元素factor_count个，连续存放)，
+ * 'v'填充变量数组(每个元素一个table)
+ * t.key = { key1,key2,... }
+ * t.factor = { key1_factor1,key1_factor2,...,key2_factor1,key2_factor2,... }
+ * t.value = { { key1_value1,key1_value2,... },{ key2_value1,... },... }
+ * t中已存在的table会被重复使用，不会重新创建
+ */
+static void lua_fillrange( lua_State *L,const char *fields,
+    class lir *_lir,int from,int n )
+{
+    // 直接遍历排行，不需要额外的内存
+    const lir::element_t *element = NULL;
+    int factor_cnt = _lir->factor_count();
+
+    if ( strchr( fields,'k' ) )
+    {
+        lua_subtable( L,"key",n );
+
+        element = _lir->seek( from );
+        for ( int i = 0;i < n;element = _lir->next( element,from + i++ ) )
+        {
+            lua_pushinteger( L,element->_key );
+            lua_rawseti( L,-2,i + 1 );
+        }
+        lua_truncate( L,n );
+        lua_pop( L,1 );
+    }
+
+    if ( strchr( fields,'f' ) )
+    {
+        lua_subtable( L,"factor",n*factor_cnt );
+
+        element = _lir->seek( from );
+        for ( int i = 0;i < n;element = _lir->next( element,from + i++ ) )
+        {
+            for ( int findex = 0;findex < factor_cnt;findex ++ )
+            {
+                lua_pushintegerornumber( L,
+                    _lir->decay_out( element->_factor[findex],findex ) );
+                lua_rawseti( L,-2,i*factor_cnt + findex + 1 );
+            }
+        }
+        lua_truncate( L,n*factor_cnt );
+        lua_pop( L,1 );
+    }
+
+    if ( strchr( fields,'v' ) )
+    {
+        lua_subtable( L,"value",n );
+
+        element = _lir->seek( from );
+        for ( int i = 0;i < n;element = _lir->next( element,from + i++ ) )
+        {
+            // 只需要到最后一个有效的变量
+            int vsz = element->_vsz;
+            while ( vsz > 0 && lir::LVT_UNDEF == element->_val[vsz - 1]._vt ) vsz --;
+
+            if ( LUA_TTABLE != lua_rawgeti( L,-1,i + 1 ) )
+            {
+                lua_pop( L,1 );
+                lua_createtable( L,vsz,0 );
+                lua_pushvalue( L,-1 );
+                lua_rawseti( L,-3,i + 1 );
+            }
+
+            for ( int vindex = 0;vindex < vsz;vindex ++ )
+            {
+                lua_pushelement( L,element->_val[vindex] );
+                lua_rawseti( L,-2,vindex + 1 );
+            }
+            lua_truncate( L,vsz );
+            lua_pop( L,1 );
+        }
+        lua_truncate( L,n );
+        lua_pop( L,1 );
+    }
+}
+
+/* 获取一段排名的数据
+ * local t,n = self:range( from,to[,fields[,t]] )
+ * fields默认为"k"，t为nil则创建一个新的table，格式见lua_fillrange
+ */
+static int range( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    lua_Integer from = luaL_checkinteger( L,2 );
+    lua_Integer to   = luaL_checkinteger( L,3 );
+    const char *fields = luaL_optstring( L,4,"k" );
+
+    if ( lua_isnoneornil( L,5 ) )
+    {
+        lua_settop( L,4 );
+        lua_newtable( L );
+    }
+    else
+    {
+        luaL_checktype( L,5,LUA_TTABLE );
+        lua_settop( L,5 );
+    }
+
+    // from、to可能超出int的范围，在lua_Integer中限制到[1,size]后再转为int
+    int size = (*_lir)->size();
+    if ( from < 1 ) from = 1;
+    if ( to > size ) to = size;
+
+    int n = to >= from ? (int)( to - from + 1 ) : 0;
+    lua_fillrange( L,fields,*_lir,n > 0 ? (int)from - 1 : 0,n );
+
+    lua_pushvalue( L,5 );
+    lua_pushinteger( L,n );
+    return 2;
+}
+
+/* 获取key前后的排名数据
+ * local t,n,pos = self:around( key_id,before,after[,fields[,t]] )
+ * 返回排名[pos - before,pos + after]的数据，格式见lua_fillrange
+ * key不在排行中则n、pos都为0
+ */
+static int around( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    lir::key_t key = luaL_checkinteger( L,2 );
+    lua_Integer before = luaL_checkinteger( L,3 );
+    lua_Integer after  = luaL_checkinteger( L,4 );
+    const char *fields = luaL_optstring( L,5,"k" );
+
+    if ( before < 0 || after < 0 )
+    {
+        return luaL_error( L,"before and after must not be negative" );
+    }
+
+    if ( lua_isnoneornil( L,6 ) )
+    {
+        lua_settop( L,5 );
+        lua_newtable( L );
+    }
+    else
+    {
+        luaL_checktype( L,6,LUA_TTABLE );
+        lua_settop( L,6 );
+    }
+
+    int pos  = (*_lir)->get_position( key );
+    int size = (*_lir)->size();
+
+    // before、after可能很大，在lua_Integer中比较后再转为int，避免溢出
+    int n = 0;
+    int from = 0;
+    if ( pos > 0 )
+    {
+        from   = before < pos ? pos - (int)before : 1;
+        int to = after < size - pos ? pos + (int)after : size;
+
+        n = to - from + 1;
+    }
+
+    lua_fillrange( L,fields,*_lir,from - 1,n );
+
+    lua_pushinteger( L,n );
+    lua_pushinteger( L,pos );
+    return 3;
+}
+
+/* 读取从index开始的所有排序因子参数，衰减模式下转换为存储的值 */
+static void lua_checkscore( lua_State *L,int index,class lir *_lir,lir::factor_t *factor )
+{
+    int top = lua_gettop( L );
+    if ( top - index + 1 > lir::MAX_FACTOR )
+    {
+        luaL_error( L,"too many ranking factor,%d at most",lir::MAX_FACTOR );
+        return;
+    }
+    if ( top < index )
+    {
+        luaL_error( L,"no ranking factor specify" );
+        return;
+    }
+
+    for ( int i = index;i <= top;i ++ )
+    {
+        factor[i - index] = luaL_checknumber( L,i );
+    }
+
+    _lir->decay_scale( factor );
+}
+
+/* 排序因子大于等于给定值的元素数量，未传入的排序因子为0
+ * local n = self:count_ge( factor1,factor2,... )
+ */
+static int count_ge( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    lir::factor_t factor[lir::MAX_FACTOR] = { 0 };
+    lua_checkscore( L,2,*_lir,factor );
+
+    lua_pushinteger( L,(*_lir)->count_better( factor,true ) );
+    return 1;
+}
+
+/* 给定排序因子对应的排名，即比它好的元素数量 + 1，相同的元素排名相同
+ * local pos = self:rank_of_score( factor1,factor2,... )
+ */
+static int rank_of_score( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    lir::factor_t factor[lir::MAX_FACTOR] = { 0 };
+    lua_checkscore( L,2,*_lir,factor );
+
+    lua_pushinteger( L,(*_lir)->count_better( factor,false ) + 1 );
+    return 1;
+}
+
+/* 获取第一个排序因子在[lo,hi]内的数据，最多limit个(0表示不限制)
+ * local t,n,pos = self:range_by_score( lo,hi[,limit[,fields[,t]]] )
+ * pos为第一个元素的排名，格式见lua_fillrange
+ */
+static int range_by_score( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    lir::factor_t lo = luaL_checknumber( L,2 );
+    lir::factor_t hi = luaL_checknumber( L,3 );
+    lua_Integer limit = luaL_optinteger( L,4,0 );
+    const char *fields = luaL_optstring( L,5,"k" );
+
+    if ( lua_isnoneornil( L,6 ) )
+    {
+        lua_settop( L,5 );
+        lua_newtable( L );
+    }
+    else
+    {
+        luaL_checktype( L,6,LUA_TTABLE );
+        lua_settop( L,6 );
+    }
+
+    lo = (*_lir)->decay_scale( lo,0 );
+    hi = (*_lir)->decay_scale( hi,0 );
+
+    // limit可能超出int的范围，在lua_Integer中比较后再转为int
+    int from = 0;
+    int n = (*_lir)->score_range( lo,hi,from );
+    if ( limit > 0 && n > limit ) n = (int)limit;
+
+    lua_fillrange( L,fields,*_lir,from,n );
+
+    lua_pushinteger( L,n );
+    lua_pushinteger( L,n > 0 ? from + 1 : 0 );
+    return 3;
+}
+
+/* 删除一个元素 */
+static int del( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    lir::key_t key = luaL_checkinteger( L,2 );
+
+    int pos = (*_lir)->del( key );
+
+    lua_pushinteger( L,pos );
+    return                 1;
+}
+
+/* 保存到文件 */
+static int save( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    int f = lua_toboolean( L,2 );
+
+    int s = (*_lir)->save( f );
+    if ( s < 0  )
+    {
+        return luaL_error( L,strerror(errno) );
+    }
+
+    // return is file acturely save
+    lua_pushboolean( L,s );
+
+    return 1;
+}
+
+/* 保存到文件 */
+static int load( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    int _errno = (*_lir)->load();
+    if ( 0 != _errno )
+    {
+        raise_error( L,_errno );
+    }
+
+    lua_pushinteger( L,(*_lir)->size() );
+
+    return 1;
+}
+
+/* 排行榜是有变化 */
+static int modify( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    lua_pushboolean( L,(*_lir)->is_modify() );
+
+    return 1;
+}
+
+/* 后台保存，返回是否开始保存。上一次后台保存未完成时抛出错误 */
+static int save_async( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    int f = lua_toboolean( L,2 );
+
+    int s = (*_lir)->save_async( f );
+    if ( s < 0  )
+    {
+        return luaL_error( L,strerror(errno) );
+    }
+
+    lua_pushboolean( L,s );
+
+    return 1;
+}
+
+/* 后台保存状态："idle"、"running"、"done"，失败时返回"error"及错误信息
+ * "done"、"error"只返回一次，之后为"idle"
+ */
+static int save_status( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    int err = 0;
+    switch ( (*_lir)->save_status( err ) )
+    {
+        case lsaver::ST_RUNNING : lua_pushstring( L,"running" );break;
+        case lsaver::ST_DONE    : lua_pushstring( L,"done"    );break;
+        case lsaver::ST_ERROR   :
+        {
+            lua_pushstring( L,"error" );
+            lua_pushstring( L,strerror( err ) );
+            return 2;
+        }break;
+        default : lua_pushstring( L,"idle" );break;
+    }
+
+    return 1;
+}
+
+/* 保存只读快照，可以用Lir.open_mapped打开 */
+static int save_snapshot( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    const char *path = luaL_checkstring( L,2 );
+    if ( (*_lir)->save_snapshot( path ) < 0 )
+    {
+        return luaL_error( L,strerror(errno) );
+    }
+
+    return 0;
+}
+
+/* 开始新的周期，本排行清空，返回旧周期的排行(可以继续查询)
+ * 指定了path时先把旧周期保存为只读快照，保存失败则不清空
+ */
+static int rollover( lua_State *L )
+{
+    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
+    if ( _lir == NULL || *_lir == NULL )
+    {
+        return luaL_error( L, "argument #1 expect" LIB_NAME );
+    }
+
+    const char *path = luaL_optstring( L,2,NULL );
+    if ( path && (*_lir)->save_snapshot( path ) < 0 )
+    {
+        return luaL_error( L,strerror(errno) );
+    }
+
+    class lir** ptr = (class lir**)lua_newuserdata(L, sizeof(class lir*));
+    *ptr = (*_lir)->rollover();
+
+    luaL_getmetatable( L,LIB_NAME );
+    lua_setmetatable( L,-2 );
+
+    return 1;
+}
+
+/* ====================只读快照(lsnapshot)======================= */
+
+static class lsnapshot *lua_checksnapshot( lua_State *L )
+{
+    // 共享排行的快照由shared_read放在upvalue中，lua代码无法构造
+    if ( lua_islightuserdata( L,lua_upvalueindex( 1 ) ) )
+    {
+        return (class lsnapshot*)lua_touserdata( L,lua_upvalueindex( 1 ) );
+    }
+
+    class lsnapshot** ptr = (class lsnapshot**)luaL_checkudata( L, 1, SNAPSHOT_NAME );
+    if ( ptr == NULL || *ptr == NULL )
+    {
+        luaL_error( L, "argument #1 expect" SNAPSHOT_NAME );
+        return NULL;
+    }
+
+    return *ptr;
+}
+
+static int snapshot_size( lua_State *L )
+{
+    class lsnapshot *snapshot = lua_checksnapshot( L );
+
+    lua_pushinteger( L,snapshot->size() );
+    return 1;
+}
+
+static int snapshot_get_key( lua_State *L )
+{
+    class lsnapshot *snapshot = lua_checksnapshot( L );
+
+    int pos = lua_tointeger( L,2 );
+    if ( pos <= 0 )
+    {
+        return luaL_error( L,"illegal rank position" );
+    }
+
+    const lir::key_t *key = snapshot->get_key( pos - 1 );
+    if ( !key ) return 0;
+
+    lua_pushinteger( L,*key );
+    return 1;
+}
+
+static int snapshot_get_position( lua_State *L )
+{
+    class lsnapshot *snapshot = lua_checksnapshot( L );
+
+    lir::key_t key = luaL_checkinteger( L,2 );
+
+    lua_pushinteger( L,snapshot->get_position( key ) );
+    return 1;
+}
+
+static int snapshot_get_factor( lua_State *L )
+{
+    class lsnapshot *snapshot = lua_checksnapshot( L );
+
+    lir::key_t key = luaL_checkinteger( L,2 );
+    int index = luaL_optinteger( L,3,0 );
+
+    const lir::factor_t *factor = NULL;
+    int factor_cnt = snapshot->get_factor( key,&factor );
+
+    if ( index > 0 )
+    {
+        if ( index > factor_cnt ) return 0;
+
+        lua_pushintegerornumber( L,*(factor + index - 1) );
+        return 1;
+    }
+
+    for ( int i = 0;i < factor_cnt;i ++ )
+    {
+        lua_pushintegerornumber( L,*(factor + i) );
+    }
+
+    return factor_cnt;
+}
+
+static int snapshot_get_value( lua_State *L )
+{
+    class lsnapshot *snapshot = lua_checksnapshot( L );
+
+    lir::key_t key = luaL_checkinteger( L,2 );
+    int index = luaL_optinteger( L,3,0 );
+
+    lir::lval_t val[lir::MAX_VALUE];
+    int val_cnt = snapshot->get_value( key,val );
+
+    if ( index > 0 )
+    {
+        if ( index > val_cnt ) return 0;
+
+        lua_pushelement( L,*(val + index - 1) );
+        return 1;
+    }
+
+    if ( !lua_checkstack( L,val_cnt ) )
+    {
+        return luaL_error( L,"stack overflow" );
+    }
+
+    for ( int i = 0;i < val_cnt;i ++ )
+    {
+        lua_pushelement( L,*(val + i) );
+    }
+
+    return val_cnt;
+}
+
+/* 把快照中排名[from,from + n)的数据填充到栈顶的table，同lua_fillrange */
+static void lua_fillsnapshot( lua_State *L,const char *fields,
+    const class lsnapshot *snapshot,int from,int n )
+{
+    int factor_cnt = snapshot->factor_count();
+
+    if ( strchr( fields,'k' ) )
+    {
+        lua_subtable( L,"key",n );
+        for ( int i = 0;i < n;i ++ )
+        {
+            lua_pushinteger( L,*(snapshot->get_key( from + i )) );
+            lua_rawseti( L,-2,i + 1 );
+        }
+        lua_truncate( L,n );
+        lua_pop( L,1 );
+    }
+
+    if ( strchr( fields,'f' ) )
+    {
+        lua_subtable( L,"factor",n*factor_cnt );
+        for ( int i = 0;i < n;i ++ )
+        {
+            const lir::factor_t *factor = snapshot->factor_at( from + i );
+            for ( int findex = 0;findex < factor_cnt;findex ++ )
+            {
+                lua_pushintegerornumber( L,factor[findex] );
+                lua_rawseti( L,-2,i*factor_cnt + findex + 1 );
+            }
+        }
+        lua_truncate( L,n*factor_cnt );
+        lua_pop( L,1 );
+    }
+
+    if ( strchr( fields,'v' ) )
+    {
+        lua_subtable( L,"value",n );
+
+        lir::lval_t val[lir::MAX_VALUE];
+        for ( int i = 0;i < n;i ++ )
+        {
+            int vsz = snapshot->value_at( from + i,val );
+            while ( vsz > 0 && lir::LVT_UNDEF == val[vsz - 1]._vt ) vsz --;
+
+            if ( LUA_TTABLE != lua_rawgeti( L,-1,i + 1 ) )
+            {
+                lua_pop( L,1 );
+                lua_createtable( L,vsz,0 );
+                lua_pushvalue( L,-1 );
+                lua_rawseti( L,-3,i + 1 );
+            }
+
+            for ( int vindex = 0;vindex < vsz;vindex ++ )
+            {
+                lua_pushelement( L,val[vindex] );
+                lua_rawseti( L,-2,vindex + 1 );
+            }
+            lua_truncate( L,vsz );
+            lua_pop( L,1 );
+        }
+        lua_truncate( L,n );
+        lua_pop( L,1 );
+    }
+}
+
+/* 获取一段排名的数据，同range
+ * local t,n = snapshot:range( from,to[,fields[,t]] )
+ */
+static int snapshot_range( lua_State *L )
+{
+    class lsnapshot *snapshot = lua_checksnapshot( L );
+
+    lua_Integer from = luaL_checkinteger( L,2 );
+    lua_Integer to   = luaL_checkinteger( L,3 );
+    const char *fields = luaL_optstring( L,4,"k" );
+
+    if ( lua_isnoneornil( L,5 ) )
+    {
+        lua_settop( L,4 );
+        lua_newtable( L );
+    }
+    else
+    {
+        luaL_checktype( L,5,LUA_TTABLE );
+        lua_settop( L,5 );
+    }
+
+    int size = snapshot->size();
+    if ( from < 1 ) from = 1;
+    if ( to > size ) to = size;
+
+    int n = to >= from ? (int)( to - from + 1 ) : 0;
+    lua_fillsnapshot( L,fields,snapshot,n > 0 ? (int)from - 1 : 0,n );
+
+    lua_pushvalue( L,5 );
+    lua_pushinteger( L,n );
+    return 2;
+}
+
+/* 获取key前后的排名数据，同around
+ * local t,n,pos = snapshot:around( key_id,before,after[,fields[,t]] )
+ */
+static int snapshot_around( lua_State *L )
+{
+    class lsnapshot *snapshot = lua_checksnapshot( L );
+
+    lir::key_t key = luaL_checkinteger( L,2 );
+    lua_Integer before = luaL_checkinteger( L,3 );
+    lua_Integer after  = luaL_checkinteger( L,4 );
+    const char *fields = luaL_optstring( L,5,"k" );
+
+    if ( before < 0 || after < 0 )
+    {
+        return luaL_error( L,"before and after must not be negative" );
+    }
+
+    if ( lua_isnoneornil( L,6 ) )
+    {
+        lua_settop( L,5 );
+        lua_newtable( L );
+    }
+    else
+    {
+        luaL_checktype( L,6,LUA_TTABLE );
+        lua_settop( L,6 );
+    }
+
+    int pos  = snapshot->get_position( key );
+    int size = snapshot->size();
+
+    int n = 0;
+    int from = 0;
+    if ( pos > 0 )
+    {
+        from   = before < pos ? pos - (int)before : 1;
+        int to = after < size - pos ? pos + (int)after : size;
+
+        n = to - from + 1;
+    }
+
+    lua_fillsnapshot( L,fields,snapshot,n > 0 ? from - 1 : 0,n );
+
+    lua_pushinteger( L,n );
+    lua_pushinteger( L,pos );
+    return 3;
+}
+
+static int snapshot_tostring( lua_State *L )
+{
+    class lsnapshot** ptr = (class lsnapshot**)luaL_checkudata(L, 1,SNAPSHOT_NAME);
+    lua_pushfstring(L, "%s: %p", SNAPSHOT_NAME, *ptr);
+    return 1;
+}
+
+static int snapshot_gc( lua_State *L )
+{
+    class lsnapshot** ptr = (class lsnapshot**)luaL_checkudata(L, 1,SNAPSHOT_NAME);
+    if ( *ptr != NULL ) delete *ptr;
+    *ptr = NULL;
+
+    return 0;
+}
+
+/* 以mmap方式打开save_snapshot保存的快照，只读 */
+static int open_mapped( lua_State *L )
+{
+    const char *path = luaL_checkstring( L,1 );
+
+    class lsnapshot* obj = new class lsnapshot();
+
+    int err = obj->open( path );
+    if ( 0 != err )
+    {
+        // 析构时会munmap、close，可能修改errno
+        int sys_errno = errno;
+        delete obj;
+        if ( err < 0 ) return luaL_error( L,strerror(sys_errno) );
+
+        raise_error( L,err );
+        return 0;
+    }
+
+    class lsnapshot** ptr = (class lsnapshot**)lua_newuserdata(L, sizeof(class lsnapshot*));
+    *ptr = obj;
+
+    luaL_getmetatable( L,SNAPSHOT_NAME );
+    lua_setmetatable( L,-2 );
+
+    return 1;
+}
+
+static void lua_snapshot_metatable( lua_State *L )
+{
+    if ( 0 == luaL_newmetatable( L,SNAPSHOT_NAME ) )
+    {
+        lua_pop( L,1 );
+        return;
+    }
+
+    lua_pushcfunction(L, snapshot_gc);
+    lua_setfield(L, -2, "__gc");
+
+    lua_pushcfunction(L, snapshot_tostring);
+    lua_setfield(L, -2, "__tostring");
+
+    lua_pushcfunction(L, snapshot_size);
+    lua_setfield(L, -2, "size");
+
+    lua_pushcfunction(L, snapshot_get_key);
+    lua_setfield(L, -2, "get_key");
+
+    lua_pushcfunction(L, snapshot_get_position);
+    lua_setfield(L, -2, "get_position");
 
-                int old_pos = 0;
-                update_factor( key,factor,factor_size,old_pos );
-            }
-        }break;
-        case ST_EVSZ: // 读取元素变量数量
-        {
-            cur_vsz = 0; // reset value size for current element
-            ifs.read( (char*)&vsz,sizeof(vsz) );
+    lua_pushcfunction(L, snapshot_get_factor);
+    lua_setfield(L, -2, "get_factor");
 
-            if ( vsz < 0 ) _errno = 8;
+    lua_pushcfunction(L, snapshot_get_value);
+    lua_setfield(L, -2, "get_value");
 
-            step = vsz > 0 ? ST_EVAL : ST_FCHK;
-        }break;
-        case ST_EVAL: // 读取变量值
-        {
-            lval_t lval;
-            ifs.read( (char*)&lval._vt,sizeof(lval._vt) );
-            if ( !ifs.good() )
-            {
-                _errno = 9;
-                continue  ;
-            }
+    lua_pushcfunction(L, snapshot_range);
+    lua_setfield(L, -2, "range");
 
-            switch( lval._vt )
-            {
-                case LVT_UNDEF   :
-                case LVT_NIL     : break;
-                case LVT_BOOLEAN : 
-                case LVT_INTEGER : 
-                    ifs.read( (char*)&lval._v._int,sizeof(lval._v._int) );break;
-                case LVT_NUMBER  :
-                    ifs.read( (char*)&lval._v._num,sizeof(lval._v._num) );break;
-                case LVT_STRING  :
-                {
-                    static const int max = 256;
-                    char buffer[max];
+    lua_pushcfunction(L, snapshot_around);
+    lua_setfield(L, -2, "around");
 
-                    int sz = read_string( ifs,buffer,max );
-                    if ( sz < 0 )
-                    {
-                        _errno = 10;
-                        continue   ;
-                    }
+    lua_pushvalue( L,-1 );
+    lua_setfield(L, -2, "__index");
 
-                    lval._v._str = buffer;//not new_string( buffer,sz );
-                }break;
-            }
+    lua_pop( L,1 );
+}
 
-            int err = update_one_value( key,cur_vsz,lval );
-            if ( err )
-            {
-                _errno = 11;
-                continue   ;
-            }
+/* 底层结构，"array"(默认)或者"tree" */
+static int lua_checkbackend( lua_State *L,int index )
+{
+    const char *bk = luaL_optstring( L,index,"array" );
+    if ( 0 == strcmp( bk,"tree" ) ) return lir::BK_TREE;
 
-            // 检查当前元素的变量是否读取完成
-            if ( ++cur_vsz >= vsz ) step ++;
-        }break;
-        case ST_FCHK: // 检查是否还有下一个元素
-        {
-            step = _cur_size >= cur_size ? ST_DONE : ST_EKEY;
-        }break;
-        case ST_DONE:
-        {
-            ifs.close();
-            return    0;
-        }break;
-        // end of switch
-        }
+    if ( 0 != strcmp( bk,"array" ) )
+    {
+        luaL_error( L,"unknow backend(argument #%d) %s",index - 1,bk );
     }
 
-    if ( !ifs.good() && ST_DONE != step ) _errno = 12;
-
-    ifs.close()  ;
-    return _errno;   
+    return lir::BK_ARRAY;
 }
 
-/* ====================LUA STATIC FUNCTION======================= */
-/* 设置玩家的排序因子
- * self:set_factor( key_id,factor1,factor2,... )
- */
-static int set_factor( lua_State *L )
+/* ====================共享排行(lshared)======================= */
+
+static class lshared *lua_checkshared( lua_State *L )
 {
-    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
-    if ( _lir == NULL || *_lir == NULL )
+    class lshared** ptr = (class lshared**)luaL_checkudata( L, 1, SHARED_NAME );
+    if ( ptr == NULL || *ptr == NULL )
     {
-        return luaL_error( L, "argument #1 expect" LIB_NAME );
+        luaL_error( L, "argument #1 expect" SHARED_NAME );
+        return NULL;
     }
 
+    return *ptr;
+}
+
+/* 在快照上执行只读接口(snapshot_*)
+ * 快照作为func的upvalue传入(见lua_checksnapshot)，参数不变
+ * 出错时也要释放快照，所以用pcall调用
+ */
+static int shared_read( lua_State *L,lua_CFunction func )
+{
+    class lshared *shared = lua_checkshared( L );
+    lshared::view_t *view = shared->get_view();
+
+    lua_pushlightuserdata( L,&(view->_snapshot) );
+    lua_pushcclosure( L,func,1 );
+    lua_insert( L,1 );
+
+    int err = lua_pcall( L,lua_gettop( L ) - 1,LUA_MULTRET,0 );
+    shared->release_view( view );
+    if ( LUA_OK != err ) return lua_error( L );
+
+    return lua_gettop( L );
+}
+
+static int shared_size( lua_State *L )
+{
+    return shared_read( L,snapshot_size );
+}
+
+static int shared_get_key( lua_State *L )
+{
+    return shared_read( L,snapshot_get_key );
+}
+
+static int shared_get_position( lua_State *L )
+{
+    return shared_read( L,snapshot_get_position );
+}
+
+static int shared_get_factor( lua_State *L )
+{
+    return shared_read( L,snapshot_get_factor );
+}
+
+static int shared_get_value( lua_State *L )
+{
+    return shared_read( L,snapshot_get_value );
+}
+
+static int shared_range( lua_State *L )
+{
+    return shared_read( L,snapshot_range );
+}
+
+static int shared_around( lua_State *L )
+{
+    return shared_read( L,snapshot_around );
+}
+
+/* 以下为写操作，参数检查完再获取写锁，持有写锁时不能抛出错误 */
+static int shared_set_factor( lua_State *L )
+{
+    class lshared *shared = lua_checkshared( L );
+
     lir::key_t key = luaL_checkinteger( L,2 );
 
     lir::factor_t factor[lir::MAX_FACTOR] = { 0 };
-    
-    int factor_cnt = 0;
-    int top = lua_gettop( L );
 
-    /* 可以一次性传入多个factor，但不能超过MAX_FACTOR */
-    if ( top - 2 > lir::MAX_FACTOR )
+    int factor_cnt = lua_gettop( L ) - 2;
+    if ( factor_cnt > lir::MAX_FACTOR )
     {
-        return luaL_error( L, 
+        return luaL_error( L,
             "too many ranking factor,%d at most",lir::MAX_FACTOR );
     }
-
-    // factor只能是number(integer)类型
-    for ( int i = 3;i <= top;i ++ )
+    if ( factor_cnt <= 0 )
     {
-        factor[factor_cnt++] = luaL_checknumber( L,i );
+        return luaL_error( L, "no ranking factor specify" );
     }
 
-    // 至少需要传入一个factor，其他可以默认为0
-    if ( factor_cnt <= 0 )
+    for ( int i = 0;i < factor_cnt;i ++ )
     {
-        return luaL_error( L, "no ranking factor specify" );
+        factor[i] = luaL_checknumber( L,i + 3 );
     }
 
     int old_pos = 0;
-    int new_pos = (*_lir)->update_factor( key,factor,factor_cnt,old_pos );
+    int new_pos = 0;
+
+    lir *_lir = shared->lock();
+    int err = _lir->check_factor( factor );
+    if ( !err )
+    {
+        _lir->decay_in( factor );
+        new_pos = _lir->update_factor( key,factor,factor_cnt,old_pos );
+    }
+    shared->unlock( !err );
+
+    if ( err ) raise_error( L,err );
 
     lua_pushinteger( L,new_pos );
     lua_pushinteger( L,old_pos );
     return 2;
 }
 
-/* 设置玩家单个排序因子
- * self:set_factor( key_id,factor1,factor2,... )
- */
-static int set_one_factor( lua_State *L )
+static int shared_set_factors_bulk( lua_State *L )
 {
-    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
-    if ( _lir == NULL || *_lir == NULL )
+    class lshared *shared = lua_checkshared( L );
+
+    int n = 0;
+    lir::update_t *updates = lua_toupdates( L,2,n );
+    int *new_pos = (int *)( updates + n );
+    int *old_pos = new_pos + n;
+
+    // 排序因子的范围和排行设置有关，要在写锁中检查
+    lir *_lir = shared->lock();
+    int err = 0;
+    for ( int i = 0;!err && i < n;i ++ )
     {
-        return luaL_error( L, "argument #1 expect" LIB_NAME );
+        err = _lir->check_factor( updates[i]._factor );
+    }
+    if ( !err )
+    {
+        for ( int i = 0;i < n;i ++ ) _lir->decay_in( updates[i]._factor );
+
+        _lir->update_factors( updates,n,new_pos,old_pos );
     }
+    shared->unlock( !err && n > 0 );
+
+    if ( err ) raise_error( L,err );
+
+    return lua_pushbulk( L,new_pos,old_pos,n );
+}
+
+static int shared_set_one_factor( lua_State *L )
+{
+    class lshared *shared = lua_checkshared( L );
 
     lir::key_t key = luaL_checkinteger( L,2 );
     lir::factor_t factor = luaL_checknumber( L,3 );
-    int index = luaL_checkinteger( L,4 );
+    lua_Integer index = luaL_checkinteger( L,4 );
 
+    if ( index < 1 )
+    {
+        return luaL_error( L,
+            "index must be in [1,%d]",lir::MAX_FACTOR );
+    }
     if ( index > lir::MAX_FACTOR )
     {
-        return luaL_error( L, 
+        return luaL_error( L,
             "too many ranking factor,%d at most",lir::MAX_FACTOR );
     }
 
     int old_pos = 0;
-    int new_pos = (*_lir)->update_one_factor( key,factor,index,old_pos );
+    int new_pos = 0;
+
+    lir *_lir = shared->lock();
+    int err = _lir->check_factor( index - 1,factor );
+    if ( !err )
+    {
+        factor  = _lir->decay_in( factor,index - 1 );
+        new_pos = _lir->update_one_factor( key,factor,index,old_pos );
+    }
+    shared->unlock( !err );
+
+    if ( err ) raise_error( L,err );
 
     lua_pushinteger( L,new_pos );
     lua_pushinteger( L,old_pos );
     return 2;
 }
 
-/* 打印整个排行榜 */
-static int dump( lua_State *L )
+static int shared_set_value( lua_State *L )
 {
-    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
-    if ( _lir == NULL || *_lir == NULL )
+    class lshared *shared = lua_checkshared( L );
+
+    lir::key_t key = luaL_checkinteger( L,2 );
+
+    int top = lua_gettop( L );
+    if ( top - 2 > lir::MAX_VALUE )
     {
-        return luaL_error( L, "argument #1 expect" LIB_NAME );
+        return luaL_error( L, "too many value,%d at most",lir::MAX_VALUE );
     }
 
-    const char *path = luaL_optstring( L,2,NULL );
+    // 字符串指向栈上的lua字符串，在函数返回前有效
+    lir::lval_t lval[lir::MAX_VALUE];
+    for ( int i = 3;i <= top;i ++ )
+    {
+        lval[i - 3] = lua_toelement( L,i );
+        if ( lir::LVT_UNDEF == lval[i - 3]._vt )
+        {
+            return luaL_error( L,
+                "unsouport value type %s",lua_typename(L, lua_type(L, i)) );
+        }
+    }
+
+    // 只有成功设置了变量，快照才需要重新生成
+    int err = 0;
+    int cnt = 0;
+    lir *_lir = shared->lock();
+    for ( int i = 0;!err && i < top - 2;i ++ )
+    {
+        err = _lir->update_one_value( key,i,lval[i] );
+        if ( !err ) cnt ++;
+    }
+    shared->unlock( cnt > 0 );
+
+    if ( err ) raise_error( L,err );
 
-    (*_lir)->dump( path );
     return 0;
 }
 
-/* 获取当前排行榜数量 */
-static int size( lua_State *L )
+static int shared_set_one_value( lua_State *L )
 {
-    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
-    if ( _lir == NULL || *_lir == NULL )
+    class lshared *shared = lua_checkshared( L );
+
+    lir::key_t key = luaL_checkinteger( L,2 );
+
+    const lir::lval_t lval = lua_toelement( L,3 );
+    if ( lir::LVT_UNDEF == lval._vt )
     {
-        return luaL_error( L, "argument #1 expect" LIB_NAME );
+        return luaL_error( L,
+            "unsouport value type %s",lua_typename(L, lua_type(L, 3)) );
     }
+    int index = luaL_checkinteger( L,4 );
 
-    lua_pushinteger( L,(*_lir)->size() );
+    lir *_lir = shared->lock();
+    int err = _lir->update_one_value( key,index - 1,lval );
+    shared->unlock( !err );
+
+    if ( err ) raise_error( L,err );
+
+    return 0;
+}
+
+static int shared_del( lua_State *L )
+{
+    class lshared *shared = lua_checkshared( L );
+
+    lir::key_t key = luaL_checkinteger( L,2 );
+
+    lir *_lir = shared->lock();
+    int pos = _lir->del( key );
+    shared->unlock( pos > 0 );
 
+    lua_pushinteger( L,pos );
     return 1;
 }
 
-/* 设置变量值 */
-static int set_value( lua_State *L )
+static int shared_save( lua_State *L )
 {
-    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
-    if ( _lir == NULL || *_lir == NULL )
+    class lshared *shared = lua_checkshared( L );
+
+    int f = lua_toboolean( L,2 );
+
+    lir *_lir = shared->lock();
+    int s = _lir->save( f );
+    int err = errno;
+    shared->unlock( false );
+
+    if ( s < 0 )
     {
-        return luaL_error( L, "argument #1 expect" LIB_NAME );
+        return luaL_error( L,strerror(err) );
     }
 
-    lir::key_t key   = luaL_checkinteger( L,2 );
-    
-    int top = lua_gettop( L );
-    for ( int i = 3;i <= top;i ++ )
-    {
-        // !!!! this lval DO NOT need to delete and CAN ONT
-        const lir::lval_t lval = lua_toelement( L,i );
-        if ( lir::LVT_UNDEF == lval._vt )
-        {
-            return luaL_error( L,
-                "unsouport value type %s",lua_typename(L, lua_type(L, i)) );
-        }
+    lua_pushboolean( L,s );
+    return 1;
+}
 
-        int err = (*_lir)->update_one_value( key,i - 3,lval );
+static int shared_load( lua_State *L )
+{
+    class lshared *shared = lua_checkshared( L );
 
-        if ( err ) raise_error( L,err );
+    lir *_lir = shared->lock();
+    int err = _lir->load();
+    int sz  = _lir->size();
+    shared->unlock( true );
+
+    if ( 0 != err ) raise_error( L,err );
+
+    lua_pushinteger( L,sz );
+    return 1;
+}
+
+/* 立即生成快照，之后的读操作能看到之前所有的写操作 */
+static int shared_publish( lua_State *L )
+{
+    class lshared *shared = lua_checkshared( L );
+
+    shared->publish();
+
+    return 0;
+}
+
+/* 两次自动生成快照的最小间隔(毫秒)，默认0 */
+static int shared_set_interval( lua_State *L )
+{
+    class lshared *shared = lua_checkshared( L );
+
+    int interval = luaL_checkinteger( L,2 );
+    if ( interval < 0 )
+    {
+        return luaL_error( L, "interval illegal" );
     }
 
+    shared->set_interval( interval );
+
+    return 0;
+}
+
+static int shared_tostring( lua_State *L )
+{
+    class lshared** ptr = (class lshared**)luaL_checkudata(L, 1,SHARED_NAME);
+    lua_pushfstring(L, "%s: %s", SHARED_NAME, *ptr ? (*ptr)->name() : "nil");
+    return 1;
+}
+
+static int shared_gc( lua_State *L )
+{
+    class lshared** ptr = (class lshared**)luaL_checkudata(L, 1,SHARED_NAME);
+    if ( *ptr != NULL ) lshared::release( *ptr );
+    *ptr = NULL;
+
     return 0;
 }
 
-/* 设置单个变量值 */
-static int set_one_value( lua_State *L )
+/* 获取共享排行，不存在则创建
+ * local shared = Lir.shared( name[,file_path[,backend]] )
+ * 同一个进程中，不同的lua_State用同一个name获取到的是同一个排行
+ */
+static int shared( lua_State *L )
 {
-    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
-    if ( _lir == NULL || *_lir == NULL )
+    size_t sz = 0;
+    const char *name = luaL_checkstring( L,1 );
+    const char *path = luaL_optlstring( L,2,name,&sz );
+    if ( sz >= (size_t)lir::MAX_PATH )
     {
-        return luaL_error( L, "argument #1 expect" LIB_NAME );
+        return luaL_error( L,"path(argument #2) too long" );
     }
 
-    lir::key_t key   = luaL_checkinteger( L,2 );
+    int backend = lua_checkbackend( L,3 );
 
-    // !!!! this lval DO NOT need to delete and CAN ONT
-    const lir::lval_t lval = lua_toelement( L,3 );
-    if ( lir::LVT_UNDEF == lval._vt )
-    {
-        return luaL_error( L,
-            "unsouport value type %s",lua_typename(L, lua_type(L, 3)) );
-    }
-    int index        = luaL_checkinteger( L,4 );
+    class lshared** ptr = (class lshared**)lua_newuserdata(L, sizeof(class lshared*));
+    *ptr = lshared::acquire( name,path,backend );
 
-    int err = (*_lir)->update_one_value( key,index - 1,lval );
-    if ( err )
-    {
-        raise_error( L,err );
-    }
+    luaL_getmetatable( L,SHARED_NAME );
+    lua_setmetatable( L,-2 );
 
-    return 0;
+    return 1;
 }
 
-/* 获取排序因子 */
-static int get_factor( lua_State *L )
+static void lua_shared_metatable( lua_State *L )
 {
-    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
-    if ( _lir == NULL || *_lir == NULL )
+    if ( 0 == luaL_newmetatable( L,SHARED_NAME ) )
     {
-        return luaL_error( L, "argument #1 expect" LIB_NAME );
+        lua_pop( L,1 );
+        return;
     }
 
-    lir::key_t key   = luaL_checkinteger( L,2 );
+    lua_pushcfunction(L, shared_gc);
+    lua_setfield(L, -2, "__gc");
 
-    int index = 0;
-    if ( !lua_isnoneornil( L,3 ) )
-    {
-        index = luaL_checkinteger  ( L,3 );
-        if ( index <= 0 || index > lir::MAX_VALUE )
-        {
-            return luaL_error( L, "argument #3 illegal" );
-        }
-    }
+    lua_pushcfunction(L, shared_tostring);
+    lua_setfield(L, -2, "__tostring");
 
-    lir::factor_t *factor = NULL;
-    int factor_cnt = (*_lir)->get_factor( key,&factor );
-    assert( factor_cnt >= 0 && factor_cnt <= lir::MAX_FACTOR );
+    lua_pushcfunction(L, shared_size);
+    lua_setfield(L, -2, "size");
 
-    // get one factor
-    if ( index > 0 )
-    {
-        if ( index >= factor_cnt ) return 0;
+    lua_pushcfunction(L, shared_get_key);
+    lua_setfield(L, -2, "get_key");
 
-        lua_pushintegerornumber( L,*(factor + index - 1) );
-        return 1;
-    }
+    lua_pushcfunction(L, shared_get_position);
+    lua_setfield(L, -2, "get_position");
 
-    if ( !lua_checkstack( L,factor_cnt ) )
-    {
-        return luaL_error( L,"stack overflow" );
-    }
+    lua_pushcfunction(L, shared_get_factor);
+    lua_setfield(L, -2, "get_factor");
 
-    for ( int i = 0;i < factor_cnt;i ++ )
-    {
-        lua_pushintegerornumber( L,*(factor + i) );
-    }
+    lua_pushcfunction(L, shared_get_value);
+    lua_setfield(L, -2, "get_value");
 
-    return factor_cnt;
-}
+    lua_pushcfunction(L, shared_range);
+    lua_setfield(L, -2, "range");
 
-/* 获取排序变量 */
-static int get_value( lua_State *L )
-{
-    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
-    if ( _lir == NULL || *_lir == NULL )
-    {
-        return luaL_error( L, "argument #1 expect" LIB_NAME );
-    }
+    lua_pushcfunction(L, shared_around);
+    lua_setfield(L, -2, "around");
 
-    lir::key_t key   = luaL_checkinteger( L,2 );
+    lua_pushcfunction(L, shared_set_factor);
+    lua_setfield(L, -2, "set_factor");
 
-    int index = 0;
-    if ( !lua_isnoneornil( L,3 ) )
-    {
-        index = luaL_checkinteger  ( L,3 );
-        if ( index <= 0 || index > lir::MAX_VALUE )
-        {
-            return luaL_error( L, "argument #3 illegal" );
-        }
-    }
+    lua_pushcfunction(L, shared_set_one_factor);
+    lua_setfield(L, -2, "set_one_factor");
 
-    lir::lval_t *val = NULL;
-    int val_cnt = (*_lir)->get_value( key,&val );
-    assert( val_cnt >= 0 );
+    lua_pushcfunction(L, shared_set_factors_bulk);
+    lua_setfield(L, -2, "set_factors_bulk");
 
-    // get one element
-    if ( index > 0 )
-    {
-        if ( index >= val_cnt ) return 0;
+    lua_pushcfunction(L, shared_set_value);
+    lua_setfield(L, -2, "set_value");
 
-        lua_pushelement( L,*(val + index - 1) );
-        return 1;
-    }
+    lua_pushcfunction(L, shared_set_one_value);
+    lua_setfield(L, -2, "set_one_value");
 
-    if ( !lua_checkstack( L,val_cnt ) )
-    {
-        return luaL_error( L,"stack overflow" );
-    }
+    lua_pushcfunction(L, shared_del);
+    lua_setfield(L, -2, "del");
 
-    // get all element
-    for ( int i = 0;i < val_cnt;i ++ )
-    {
-        lua_pushelement( L,*(val + i) );
-    }
+    lua_pushcfunction(L, shared_save);
+    lua_setfield(L, -2, "save");
 
-    return val_cnt;
+    lua_pushcfunction(L, shared_load);
+    lua_setfield(L, -2, "load");
+
+    lua_pushcfunction(L, shared_publish);
+    lua_setfield(L, -2, "publish");
+
+    lua_pushcfunction(L, shared_set_interval);
+    lua_setfield(L, -2, "set_interval");
+
+    lua_pushvalue( L,-1 );
+    lua_setfield(L, -2, "__index");
+
+    lua_pop( L,1 );
 }
 
-/* 根据排名获取唯一key */
-static int get_position( lua_State *L )
+/* ====================合并排行(lmerge)======================= */
+
+static class lmerge *lua_checkmerge( lua_State *L )
 {
-    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
-    if ( _lir == NULL || *_lir == NULL )
+    class lmerge** ptr = (class lmerge**)luaL_checkudata( L, 1, MERGE_NAME );
+    if ( ptr == NULL || *ptr == NULL )
     {
-        return luaL_error( L, "argument #1 expect" LIB_NAME );
+        luaL_error( L, "argument #1 expect" MERGE_NAME );
+        return NULL;
     }
 
-    lir::key_t key = luaL_checkinteger( L,2 );
+    // 排行为空时仍然可以开启衰减模式，每次查询都要检查
+    int err = (*ptr)->check();
+    if ( err ) raise_error( L,err );
 
-    lua_pushinteger( L,(*_lir)->get_position( key ) );
+    return *ptr;
+}
+
+static int merge_size( lua_State *L )
+{
+    class lmerge *merge = lua_checkmerge( L );
 
+    lua_pushinteger( L,merge->size() );
     return 1;
 }
 
-/* 根据唯一key获取排名 */
-static int get_key( lua_State *L )
+/* 根据全服排名获取key及所在排行(Lir.merge参数中的位置) */
+static int merge_get_key( lua_State *L )
 {
-    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
-    if ( _lir == NULL || *_lir == NULL )
-    {
-        return luaL_error( L, "argument #1 expect" LIB_NAME );
-    }
+    class lmerge *merge = lua_checkmerge( L );
 
     int pos = lua_tointeger( L,2 );
     if ( pos <= 0 )
@@ -1033,86 +4295,157 @@ static int get_key( lua_State *L )
         return luaL_error( L,"illegal rank position" );
     }
 
-    lir::key_t *key = (*_lir)->get_key( pos - 1 );
-
-    if ( !key ) return 0;
+    lir::key_t key = 0;
+    int shard = merge->get_key( pos - 1,key );
+    if ( shard < 0 ) return 0;
 
-    lua_pushinteger( L,*key );
-    return                  1;
+    lua_pushinteger( L,key );
+    lua_pushinteger( L,shard + 1 );
+    return 2;
 }
 
-/* 删除一个元素 */
-static int del( lua_State *L )
+/* 根据key获取全服排名及所在排行，不存在返回0 */
+static int merge_get_position( lua_State *L )
 {
-    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
-    if ( _lir == NULL || *_lir == NULL )
-    {
-        return luaL_error( L, "argument #1 expect" LIB_NAME );
-    }
+    class lmerge *merge = lua_checkmerge( L );
 
     lir::key_t key = luaL_checkinteger( L,2 );
 
-    int pos = (*_lir)->del( key );
+    int shard = 0;
+    int pos = merge->get_position( key,shard );
+    if ( pos <= 0 )
+    {
+        lua_pushinteger( L,0 );
+        return 1;
+    }
 
     lua_pushinteger( L,pos );
-    return                 1;
+    lua_pushinteger( L,shard + 1 );
+    return 2;
 }
 
-/* 保存到文件 */
-static int save( lua_State *L )
+/* 全服前n名
+ * local keys,shards = merge:top( n )
+ */
+static int merge_top( lua_State *L )
 {
-    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
-    if ( _lir == NULL || *_lir == NULL )
+    class lmerge *merge = lua_checkmerge( L );
+
+    int n = luaL_checkinteger( L,2 );
+
+    std::vector<lir::key_t> keys;
+    std::vector<int> shards;
+    int cnt = merge->top( n,keys,shards );
+
+    lua_createtable( L,cnt,0 );
+    for ( int i = 0;i < cnt;i ++ )
     {
-        return luaL_error( L, "argument #1 expect" LIB_NAME );
+        lua_pushinteger( L,keys[i] );
+        lua_rawseti( L,-2,i + 1 );
     }
 
-    int f = lua_toboolean( L,2 );
-
-    int s = (*_lir)->save( f );
-    if ( s < 0  )
+    lua_createtable( L,cnt,0 );
+    for ( int i = 0;i < cnt;i ++ )
     {
-        return luaL_error( L,strerror(errno) );
+        lua_pushinteger( L,shards[i] + 1 );
+        lua_rawseti( L,-2,i + 1 );
     }
 
-    // return is file acturely save
-    lua_pushboolean( L,s );
+    return 2;
+}
 
+static int merge_tostring( lua_State *L )
+{
+    class lmerge** ptr = (class lmerge**)luaL_checkudata(L, 1,MERGE_NAME);
+    lua_pushfstring(L, "%s: %p", MERGE_NAME, *ptr);
     return 1;
 }
 
-/* 保存到文件 */
-static int load( lua_State *L )
+static int merge_gc( lua_State *L )
 {
-    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
-    if ( _lir == NULL || *_lir == NULL )
+    class lmerge** ptr = (class lmerge**)luaL_checkudata(L, 1,MERGE_NAME);
+    if ( *ptr != NULL ) delete *ptr;
+    *ptr = NULL;
+
+    return 0;
+}
+
+/* 多个排行合并后的全服排行
+ * local merge = Lir.merge( lir1,lir2,... )
+ * 各个排行仍然独立更新，查询时才合并
+ */
+static int merge( lua_State *L )
+{
+    int top = lua_gettop( L );
+    if ( top <= 0 )
     {
-        return luaL_error( L, "argument #1 expect" LIB_NAME );
+        return luaL_error( L,"no ranking specify" );
     }
 
-    int _errno = (*_lir)->load();
-    if ( 0 != _errno )
+    for ( int i = 1;i <= top;i ++ )
     {
-        raise_error( L,_errno );
+        class lir** _lir = (class lir**)luaL_checkudata( L, i, LIB_NAME );
+        if ( *_lir == NULL )
+        {
+            return luaL_error( L, "argument #%d expect" LIB_NAME,i );
+        }
+        if ( (*_lir)->is_decay() ) raise_error( L,24 );
     }
 
-    lua_pushinteger( L,(*_lir)->size() );
+    class lmerge* obj = new class lmerge();
+    for ( int i = 1;i <= top;i ++ )
+    {
+        obj->add( *(class lir**)lua_touserdata( L,i ) );
+    }
+
+    class lmerge** ptr = (class lmerge**)lua_newuserdata(L, sizeof(class lmerge*));
+    *ptr = obj;
+
+    luaL_getmetatable( L,MERGE_NAME );
+    lua_setmetatable( L,-2 );
+
+    // 引用所有排行，避免在合并排行之前被回收
+    lua_createtable( L,top,0 );
+    for ( int i = 1;i <= top;i ++ )
+    {
+        lua_pushvalue( L,i );
+        lua_rawseti( L,-2,i );
+    }
+    lua_setuservalue( L,-2 );
 
     return 1;
 }
 
-/* 排行榜是有变化 */
-static int modify( lua_State *L )
+static void lua_merge_metatable( lua_State *L )
 {
-    class lir** _lir = (class lir**)luaL_checkudata( L, 1, LIB_NAME );
-    if ( _lir == NULL || *_lir == NULL )
+    if ( 0 == luaL_newmetatable( L,MERGE_NAME ) )
     {
-        return luaL_error( L, "argument #1 expect" LIB_NAME );
+        lua_pop( L,1 );
+        return;
     }
 
-    lua_pushboolean( L,(*_lir)->is_modify() );
+    lua_pushcfunction(L, merge_gc);
+    lua_setfield(L, -2, "__gc");
 
-    return 1;
+    lua_pushcfunction(L, merge_tostring);
+    lua_setfield(L, -2, "__tostring");
+
+    lua_pushcfunction(L, merge_size);
+    lua_setfield(L, -2, "size");
+
+    lua_pushcfunction(L, merge_get_key);
+    lua_setfield(L, -2, "get_key");
+
+    lua_pushcfunction(L, merge_get_position);
+    lua_setfield(L, -2, "get_position");
+
+    lua_pushcfunction(L, merge_top);
+    lua_setfield(L, -2, "top");
+
+    lua_pushvalue( L,-1 );
+    lua_setfield(L, -2, "__index");
+
+    lua_pop( L,1 );
 }
 
 /* create a C++ object and push to lua stack */
@@ -1126,7 +4459,9 @@ static int __call( lua_State *L )
         return luaL_error( L,"path(argument #1) too long" );
     }
 
-    class lir* obj = new class lir( path );
+    int backend = lua_checkbackend( L,3 );
+
+    class lir* obj = new class lir( path,backend );
 
     lua_settop( L,1 ); /* 清除所有构造函数参数,只保留元表 */
 
@@ -1193,6 +4528,48 @@ int luaopen_lua_insertion_ranking( lua_State *L )
     lua_pushcfunction(L, set_factor);
     lua_setfield(L, -2, "set_factor");
 
+    lua_pushcfunction(L, set_factors_bulk);
+    lua_setfield(L, -2, "set_factors_bulk");
+
+    lua_pushcfunction(L, set_packed);
+    lua_setfield(L, -2, "set_packed");
+
+    lua_pushcfunction(L, set_intern);
+    lua_setfield(L, -2, "set_intern");
+
+    lua_pushcfunction(L, set_decay);
+    lua_setfield(L, -2, "set_decay");
+
+    lua_pushcfunction(L, set_time);
+    lua_setfield(L, -2, "set_time");
+
+    lua_pushcfunction(L, set_max_size);
+    lua_setfield(L, -2, "set_max_size");
+
+    lua_pushcfunction(L, set_journal);
+    lua_setfield(L, -2, "set_journal");
+
+    lua_pushcfunction(L, set_track);
+    lua_setfield(L, -2, "set_track");
+
+    lua_pushcfunction(L, set_watch);
+    lua_setfield(L, -2, "set_watch");
+
+    lua_pushcfunction(L, get_events);
+    lua_setfield(L, -2, "get_events");
+
+    lua_pushcfunction(L, set_stats);
+    lua_setfield(L, -2, "set_stats");
+
+    lua_pushcfunction(L, stats);
+    lua_setfield(L, -2, "stats");
+
+    lua_pushcfunction(L, get_seq);
+    lua_setfield(L, -2, "get_seq");
+
+    lua_pushcfunction(L, changes_since);
+    lua_setfield(L, -2, "changes_since");
+
     lua_pushcfunction(L, set_value);
     lua_setfield(L, -2, "set_value");
 
@@ -1214,6 +4591,21 @@ int luaopen_lua_insertion_ranking( lua_State *L )
     lua_pushcfunction(L, del);
     lua_setfield(L, -2, "del");
 
+    lua_pushcfunction(L, range);
+    lua_setfield(L, -2, "range");
+
+    lua_pushcfunction(L, around);
+    lua_setfield(L, -2, "around");
+
+    lua_pushcfunction(L, count_ge);
+    lua_setfield(L, -2, "count_ge");
+
+    lua_pushcfunction(L, rank_of_score);
+    lua_setfield(L, -2, "rank_of_score");
+
+    lua_pushcfunction(L, range_by_score);
+    lua_setfield(L, -2, "range_by_score");
+
     lua_pushcfunction(L, save);
     lua_setfield(L, -2, "save");
 
@@ -1223,6 +4615,30 @@ int luaopen_lua_insertion_ranking( lua_State *L )
     lua_pushcfunction(L, modify);
     lua_setfield(L, -2, "modify");
 
+    lua_pushcfunction(L, save_async);
+    lua_setfield(L, -2, "save_async");
+
+    lua_pushcfunction(L, save_status);
+    lua_setfield(L, -2, "save_status");
+
+    lua_pushcfunction(L, save_snapshot);
+    lua_setfield(L, -2, "save_snapshot");
+
+    lua_pushcfunction(L, rollover);
+    lua_setfield(L, -2, "rollover");
+
+    lua_snapshot_metatable( L );
+    lua_pushcfunction(L, open_mapped);
+    lua_setfield(L, -2, "open_mapped");
+
+    lua_shared_metatable( L );
+    lua_pushcfunction(L, shared);
+    lua_setfield(L, -2, "shared");
+
+    lua_merge_metatable( L );
+    lua_pushcfunction(L, merge);
+    lua_setfield(L, -2, "merge");
+
     /* metatable as value and pop metatable */
     lua_pushvalue( L,-1 );
     lua_setfield(L, -2, "__index");
@@ -1,18 +1,21 @@
 #ifndef __LINSERTION_RANKING_H__
 #define __LINSERTION_RANKING_H__
 
-#if __cplusplus < 201103L    /* -std=gnu99 */
-    #include <map>
-    #define map    std::map
-#else                       /* if support C++ 2011 */
-    #include <unordered_map>
-    #define map    std::unordered_map
-#endif
-
 #include <iostream>     // std::streambuf, std::cout
 #include <cstring>
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <deque>
 
 #include <lua.hpp>
+#include "lpool.hpp"
+#include "lintern.hpp"
+#include "lbuffer.hpp"
+#include "lsaver.hpp"
+#include "lstat.hpp"
+#include "lkmap.hpp"
+
 extern "C"
 {
 extern int luaopen_lua_insertion_ranking( lua_State *L );
@@ -26,9 +29,31 @@ public:
 
     const static int DEFAULT_SIZE = 32; // 默认分配排行数组大小
 
+    // 排行底层结构
+    typedef enum
+    {
+        BK_ARRAY = 0, // 插入排序数组，适合少量元素
+        BK_TREE       // 顺序统计树(treap)，所有操作O(logn)，适合大量元素
+    }backend_t;
+
     // 默认变量分配大小
     const static int MAX_VALUE = 256;
     const static int DEFAULT_VALUE = 8;
+    const static int VALUE_POOL = 6; // 变量数组内存池数量，8、16 ... 256
+
+    const static int SSO_SIZE = 16; // 小于该长度的字符串直接存放在lval_t中
+
+    // 批量更新的元素数量 * BULK_MERGE_RATIO >= 排行数量时，排序后一次合并，否则逐个移动
+    const static int BULK_MERGE_RATIO = 32;
+
+    // 批量更新的方式，见update_factors
+    typedef enum
+    {
+        BM_AUTO   = 0, // 根据排行选择
+        BM_SINGLE = 1, // 逐个调用update_factor
+        BM_MERGE  = 2, // 移出所有元素，排序后一次合并回去
+        BM_SHIFT  = 3  // 逐个移动到新的位置
+    }bulk_mode_t;
 
     typedef double factor_t  ; // 排序因子类型
     typedef LUA_INTEGER key_t; // key类型，如玩家pid.LUA_INTEGER = int64_t lua5.3
@@ -44,44 +69,177 @@ public:
         LVT_STRING
     }lvt_t;
 
+    // LVT_STRING的存储方式
+    typedef enum
+    {
+        LSF_PTR    = 0, // _str，new_string分配的内存(传入的参数则是借用的指针)
+        LSF_INLINE    , // _sso，短字符串直接存放
+        LSF_INTERN      // _str，字符串常量池中的字符串
+    }lsf_t;
+
     // 用于表示一个lua变量
     typedef struct
     {
         lvt_t _vt;
+        unsigned char _sf; // LVT_STRING的存储方式，见lsf_t
         union
         {
             char       *_str; 
             LUA_NUMBER  _num;
             LUA_INTEGER _int;
+            char        _sso[SSO_SIZE];
         }_v;
     }lval_t;
 
+    struct tnode;
+
     // 表示一个排序元素
     typedef struct
     {
-        int      _pos;
+        int      _pos; // BK_ARRAY下的排名缓存，可能过期，用position获取。BK_TREE下无效
         int      _vsz;
         key_t    _key;
+        int64_t  _ver; // 最后一次变更的序号(_seq)
         lval_t  *_val; // it is a array,size is _header_size
+        struct tnode *_node; // BK_TREE下对应的树节点
         factor_t _factor[MAX_FACTOR];
     }element_t;
 
-    typedef map< key_t,element_t *> kmap_t;
-    typedef map< key_t,element_t *>::iterator kmap_iterator;
+    // 排序因子，连续存放在排行数组中，对比时不需要再访问element
+    // 设置了压缩排序因子(set_packed)时，存放的是压缩后的128位整数
+    typedef union
+    {
+        factor_t _factor[MAX_FACTOR];
+        struct
+        {
+            uint64_t _hi;
+            uint64_t _lo;
+        }_pk;
+    }skey_t;
+
+    // 顺序统计树节点，中序即为排名顺序
+    typedef struct tnode
+    {
+        skey_t        _skey;
+        struct tnode *_left;
+        struct tnode *_right;
+        struct tnode *_parent;
+        element_t    *_element;
+        int           _size; // 子树元素数量
+        unsigned int  _prio; // treap优先级
+    }tnode_t;
+
+    // 批量更新中的一个更新
+    typedef struct
+    {
+        key_t    _key;
+        int      _cnt; // 排序因子数量
+        factor_t _factor[MAX_FACTOR];
+    }update_t;
+
+    // 保存文件头，后面是serialize的数据
+    const static uint32_t FILE_MAGIC   = 0x3252494C; // "LIR2"
+    const static uint32_t FILE_VERSION = 3; // 3:数据前面是衰减的基准时间(double)
+    typedef struct
+    {
+        uint32_t _magic;
+        uint32_t _version;
+        uint32_t _crc;     // 数据的crc32
+        uint32_t _generation; // 代数，每次写完整文件加1
+        uint64_t _size;    // 数据长度
+    }file_header_t;
+
+    // 变更日志(<path>.jnl)文件头，后面是多个批次，每次save追加一个批次：
+    // crc32(4字节)、长度(varint)、多条变更记录
+    const static uint32_t JOURNAL_MAGIC   = 0x4A52494C; // "LIRJ"
+    const static uint32_t JOURNAL_VERSION = 1;
+    typedef struct
+    {
+        uint32_t _magic;
+        uint32_t _version;
+        uint64_t _generation; // 对应完整文件的代数，不相同则日志无效
+    }journal_header_t;
+
+    // 变更记录类型
+    typedef enum
+    {
+        JOP_FACTOR = 1, // update_factor
+        JOP_ONE_FACTOR, // update_one_factor
+        JOP_VALUE     , // update_one_value
+        JOP_DEL       , // del
+        JOP_BULK        // update_factors
+    }jop_t;
+
+    // 日志小于该值或者完整文件大小时，save只追加日志
+    const static size_t JOURNAL_MIN = 64*1024;
+
+    // 一个变更，见changes_since
+    typedef struct
+    {
+        int64_t _seq;
+        key_t   _key;
+        int     _from; // 排名变化的范围，_from为0表示排名没有变化
+        int     _to;
+    }change_t;
+
+    const static int MAX_THRESHOLD = 8; // 最多监听的排名阈值数量
+
+    // 衰减模式下，存储的值超过2^DECAY_REBASE倍时重设基准时间
+    const static int DECAY_REBASE = 64;
+
+    typedef enum
+    {
+        EV_NONE  = 0,
+        EV_MOVE  = 1, // 排名变化，_to为0表示被删除
+        EV_ENTER = 2, // 进入前_rank名
+        EV_LEAVE = 3  // 离开前_rank名
+    }event_type_t;
+
+    // 一个排名事件，见set_watch
+    typedef struct
+    {
+        int   _type;
+        key_t _key;
+        key_t _other; // 被超越(或超越_key)、被挤出(或补进)阈值的元素，0表示没有
+        int   _from;  // 原排名，0表示新元素
+        int   _to;    // 新排名，0表示被删除
+        int   _rank;  // 阈值，EV_ENTER、EV_LEAVE才有
+    }event_t;
+
+    // 运行统计，见set_stats
+    typedef struct
+    {
+        int64_t _compare; // 对比排序因子(compare_key)次数
+        int64_t _lookup;  // 用key查找元素次数
+        int64_t _alloc;   // 从内存池分配元素、树节点、变量数组次数
+        lhistogram _update; // 更新排序因子耗时(纳秒)
+        lhistogram _bulk;   // 批量更新耗时(纳秒)
+        lhistogram _del;    // 删除耗时(纳秒)
+        lhistogram _moved;  // 每次更新、删除排名变化的距离
+        lhistogram _save;   // 保存耗时(纳秒)
+        lhistogram _load;   // 加载耗时(纳秒)
+    }stat_t;
+
 public:
     ~lir();
-    explicit lir( const char *path );
+    explicit lir( const char *path,int backend = BK_ARRAY );
 
     // 打印排行榜到std::cout或者文件
     void dump( const char *path );
 
     // 更新排序因子，不存在则尝试插入
-    int update_factor( key_t key,factor_t *factor,int factor_cnt,int &old_pos );
+    int update_factor( key_t key,const factor_t *factor,int factor_cnt,int &old_pos );
     // 更新单个排序因子
     int update_one_factor( key_t key,factor_t factor,int index,int &old_pos );
+    // 批量更新排序因子，new_pos、old_pos和updates一一对应
+    // mode为bulk_mode_t，重放日志时使用记录的方式，保证排序因子相同的元素顺序一致
+    int update_factors( const update_t *updates,int n,
+        int *new_pos,int *old_pos,int mode = BM_AUTO );
 
     // 当前排行的数量，最大数量，设置最大数量
     inline int size() { return _cur_size; }
+    inline int max_size() { return _limit; }
+    void set_max_size( int max_size );
 
     // 设置一个变量
     int update_one_value( key_t key,int index,const lval_t &lval );
@@ -94,35 +252,180 @@ public:
 
     // 根据key获取所在排名
     int get_position( const key_t &key );
+    // 排序因子比factor好的元素数量，equal为true时包括相同的
+    int count_better( const factor_t *factor,bool equal );
+    // 第一个排序因子在[lo,hi]内的元素数量，这些元素排名连续，from为第一个的索引(从0开始)
+    int score_range( factor_t lo,factor_t hi,int &from );
 
     // 根据排行获取key
     key_t *get_key( int pos );
 
+    // 按排名遍历，index从0开始
+    element_t *seek( int index );
+    element_t *next( const element_t *element,int index );
+
+    // 当前排序因子数量
+    inline int factor_count() { return _cur_factor; }
+
+    // 底层结构
+    inline int backend() { return _backend; }
+
     // 删除一个元素
     int del( const key_t &key );
 
     // 保存到文件
     int save( int f );
+    // 后台保存到文件，用save_status查询结果
+    int save_async( int f );
+    int save_status( int &err );
+
+    // 开启变更日志
+    void set_journal( bool on );
+
+    // 记录最近capacity个变更，0表示不记录
+    void set_track( int capacity );
+    inline int64_t get_seq() { return _seq; }
+    // seq之后变化的key、删除的key，以及排名变化的范围[from,to](from为0表示没有)
+    // seq太旧，变更已被丢弃时返回false
+    bool changes_since( int64_t seq,std::vector<key_t> &keys,
+        std::vector<key_t> &deleted,int &from,int &to );
+
+    // 开启排名事件，最多缓存capacity个事件，0表示关闭
+    // thresholds为监听的排名阈值(如前1、前10名)，升序排列
+    int set_watch( int capacity,const int *thresholds,int cnt );
+    // 取出最多max个事件，返回取出的数量。dropped为缓存满时丢弃的事件数量
+    int get_events( std::vector<event_t> &events,int max,int64_t &dropped );
 
     // 从文件加载数据
     int load();
 
+    // 开启运行统计，关闭时统计数据保留
+    void set_stats( bool on );
+    inline const stat_t &get_stats() { return _stat; }
+    void reset_stats();
+    // 内存池申请的内存块数量
+    size_t chunk_count();
+
     // 文件是否改变(以上次保存文件为准)
     int is_modify() { return _modify; }
 
+    // 设置压缩排序因子，只能在排行为空时设置
+    int set_packed( const int *bits,int cnt );
+    // 检查排序因子是否能压缩，不能则返回错误码
+    int check_factor( int index,factor_t factor );
+    int check_factor( const factor_t *factor );
+
+    // 开启字符串常量池
+    void set_intern( bool on );
+
+    // 开启衰减模式，第index(从1开始)个排序因子每经过half_life秒减半，0表示关闭
+    // 只能在排行为空时设置，不能和压缩排序因子同时使用
+    int set_decay( double half_life,int index );
+    // 设置当前时间(秒)，0表示使用系统时间
+    void set_time( double now );
+    // 衰减模式下，当前的值转换为存储的值，index从0开始，factor为MAX_FACTOR个排序因子
+    factor_t decay_in( factor_t factor,int index );
+    void decay_in( factor_t *factor );
+    // 同decay_in，但不会重设基准时间，用于查询
+    factor_t decay_scale( factor_t factor,int index );
+    void decay_scale( factor_t *factor );
+    // 存储的值转换为当前的值
+    factor_t decay_out( factor_t factor,int index );
+    // 是否开启了衰减模式
+    inline bool is_decay() { return _decay_index >= 0; }
+
     static void  del_string( const char *str );
     static char *new_string( const char *str,size_t sz = 0 );
+
+    // 取LVT_STRING变量的字符串
+    static const char *lval_str( const lval_t &lval )
+    {
+        return LSF_INLINE == lval._sf ? lval._v._sso : lval._v._str;
+    }
+
+    // 读取一个序列化的变量，返回错误码
+    static int decode_value( lreader &reader,int &index,lval_t &lval );
+
+    // 保存只读快照，用lsnapshot以mmap方式打开
+    int save_snapshot( const char *path );
+    // 生成只读快照数据，用lsnapshot读取
+    void snapshot( lbuffer &buffer );
+
+    // 开始新的周期，当前所有元素移到返回的排行中(由调用者释放)，本排行清空
+    // 只交换内部结构，耗时与排行大小无关
+    lir *rollover();
+
+    // 对比排序因子，大于返回1，等于返回0，小于返回-1
+    static int compare( const factor_t *fsrc,const factor_t *fdest );
 private:
     void del_lval( const lval_t &lval );
-    void del_element( const element_t *element );
+    void del_element( element_t *element );
+    lval_t *new_value( int sz );
+    void del_value( lval_t *val,int sz );
     void cpy_lval( lval_t &to,const lval_t &from );
 
     int shift_up  ( element_t *element );
     int shift_down( element_t *element );
-    int append( key_t key,factor_t *factor );
+    int append( key_t key,const factor_t *factor );
+    element_t *recycle( element_t *last,key_t key,const factor_t *factor );
+    int insert( element_t *element );
+    element_t *new_element( key_t key,const factor_t *factor );
+
+    // 批量更新
+    struct batch_greater;
+    struct batch_key_less;
+    friend struct batch_greater;
+    void merge( const std::vector<element_t *> &moved,std::vector<int> &removed );
+    void tree_merge( const std::vector<element_t *> &moved );
+
+    // 排序因子变化后调整元素位置，shift > 0 表示排名上升
+    int reposition( element_t *element,int shift );
+    // 元素当前排名(从1开始)，会修正过期的_pos
+    int position( element_t *element );
+    int locate( const element_t *element );
+
+    // 顺序统计树(BK_TREE)，实现在lranking_tree.cpp
+    int  tree_insert( tnode_t *node,int shift );
+    void tree_remove( tnode_t *node );
+    int  tree_rank  ( const tnode_t *node );
+    void tree_free  ( tnode_t *node );
+    tnode_t *tree_select( int index );
+    tnode_t *tree_next  ( const tnode_t *node );
+    void tree_rotate( tnode_t *node );
+    void tree_build ( element_t **elements,int n );
+    int  tree_count ( const factor_t *factor,int limit );
+
+    // 排行数组操作(BK_ARRAY)，_list、_skey必须同时修改
+    void reserve( int size );
+    void move( int dst,int src,int n );
+    void place( int index,element_t *element );
+
+    void make_key( skey_t &key,const factor_t *factor );
+    int compare_key( const skey_t *ksrc,const skey_t *kdest )
+    {
+        if ( _stat_on ) _stat._compare ++;
+
+        if ( _packed )
+        {
+            if ( ksrc->_pk._hi != kdest->_pk._hi )
+            {
+                return ksrc->_pk._hi > kdest->_pk._hi ? 1 : -1;
+            }
+
+            return ( ksrc->_pk._lo > kdest->_pk._lo ) - ( ksrc->_pk._lo < kdest->_pk._lo );
+        }
+
+        return compare( ksrc->_factor,kdest->_factor );
+    }
+
+    // 用key查找元素
+    element_t *find_key( key_t key )
+    {
+        if ( _stat_on ) _stat._lookup ++;
+
+        return (element_t *)_kmap.find( key );
+    }
 
-    // 对比排序因子
-    int compare( const factor_t *fsrc,const factor_t *fdest );
     int compare( const element_t *esrc,const element_t *edest )
     {
         return compare( esrc->_factor,edest->_factor );
@@ -130,16 +433,50 @@ private:
 
     void raw_dump( std::ostream &os );
 
-    // 写入字符串(长度加字符串内容)
-    std::ostream &write_string( std::ostream &os,const char *str )
-    {
-        size_t sz = strlen( str );
-        os.write( (char*)&sz,sizeof(sz) );
-
-        os.write( str,sz );
-        return          os;
-    }
-    // 读取字符串
+    // 文件读写，见save、load
+    void serialize( lbuffer &buffer );
+    void pack( lbuffer &buffer );
+    static void seal( lbuffer *buffer );
+    int  unserialize( const char *data,size_t sz );
+    int  unserialize_value( lreader &reader,element_t *element );
+    void serialize_value( lbuffer &buffer,const element_t *element );
+    static void encode_value( lbuffer &buffer,int index,const lval_t &lval );
+    int  load_v1();
+    int  load_file();
+    static int read_file( const char *path,std::vector<char> &data );
+
+    // 变更记录，实现在lranking_track.cpp
+    void track( element_t *element,int old_pos,int new_pos,bool bulk = false );
+    void track_del( key_t key,int from,int to );
+    int  track_insert( int pos );
+    inline bool tracking() { return _track_cap > 0 || _watch_cap > 0 || _stat_on; }
+
+    // 排名事件，实现在lranking_event.cpp
+    void watch( element_t *element,int old_pos,int new_pos );
+    void watch_del( key_t key,int pos );
+    void watch_clear();
+    void watch_bulk( const std::vector<element_t *> &moved,
+        const std::vector<int> &old_pos,const std::vector<int> &new_pos );
+    key_t watch_other( int old_pos,int new_pos );
+    void push_event( int type,key_t key,key_t other,int from,int to,int rank );
+
+    // 变更日志，实现在lranking_journal.cpp
+    const char *journal_path( std::string &path );
+    void journal_header( lbuffer &buffer );
+    void journal_factor( key_t key,const factor_t *factor,int cnt );
+    void journal_one_factor( key_t key,factor_t factor,int index );
+    void journal_value( key_t key,int index,const lval_t &lval );
+    void journal_del( key_t key );
+    void journal_bulk( const update_t *updates,int n,int mode );
+    bool journal_append();
+    int  journal_replay();
+    int  journal_apply( const char *data,size_t sz );
+
+    // 衰减模式，实现在lranking_decay.cpp
+    double decay_now();
+    void decay_rebase( double now );
+
+    // 读取字符串(旧版本文件)
     int read_string( std::istream &is,char *buffer,int max )
     {
         size_t sz = 0;
@@ -157,11 +494,59 @@ private:
 
     int _cur_factor; // 当前排序因子数量
 
-    int _cur_size;    // _list的有效大小
-    int _max_size;    // _list分配的大小
-    element_t **_list; // 排行数组
+    int _packed;              // 压缩的排序因子数量，0表示不压缩
+    int _pbits[MAX_FACTOR];   // 每个排序因子压缩后占用的位数
 
-    kmap_t _kmap;  // 以排行key则k-v映射，方便用key直接取排名
+    int _backend;     // 底层结构，见backend_t
+
+    int _cur_size;    // 元素数量
+    int _limit;       // 排行最大数量，0表示不限制
+    int _max_size;    // _list分配的大小
+    element_t **_list; // 排行数组(BK_ARRAY)
+    skey_t     *_skey; // 和_list一一对应的排序因子，移动元素时顺序扫描这个数组
+
+    tnode_t *_root;       // 顺序统计树根节点(BK_TREE)
+    unsigned int _seed;   // treap优先级随机种子
+
+    lkmap  _kmap;  // 以排行key则k-v映射，方便用key直接取排名
+
+    bool    _intern_on; // 是否使用字符串常量池
+    lintern _intern;    // 字符串常量池
+
+    int64_t _seq;       // 变更序号，每个变更加1
+    int     _track_cap; // 最多记录的变更数量，0表示不记录
+    int64_t _track_min; // 已丢弃的最大序号，比它小的changes_since无法获取完整的变更
+    std::deque<change_t> _changes; // 最近的变更，按序号排序
+
+    int     _watch_cap;     // 最多缓存的事件数量，0表示不记录
+    int     _watch_top;     // 最大的阈值，只记录该排名以内的EV_MOVE，0表示全部
+    int     _th_cnt;        // 阈值数量
+    int     _thresholds[MAX_THRESHOLD]; // 监听的排名阈值，升序
+    int     _ev_head;       // 环形缓冲区中最旧事件的位置
+    int     _ev_cnt;        // 缓存的事件数量
+    int64_t _ev_dropped;    // 缓存满时丢弃的事件数量
+    std::vector<event_t> _events; // 事件环形缓冲区
+
+    bool     _journal_on;   // 是否记录变更日志
+    bool     _compact;      // 下次保存必须写完整文件(日志不可用)
+    uint32_t _generation;   // 完整文件的代数
+    size_t   _base_size;    // 完整文件大小
+    size_t   _journal_size; // 日志文件大小
+    lbuffer  _jpending;     // 未写入日志文件的变更
+
+    lpool  _epool; // element_t内存池
+    lpool  _npool; // tnode_t内存池
+    lpool *_vpool[VALUE_POOL]; // 变量数组内存池
+
+    int    _decay_index; // 衰减的排序因子下标(从0开始)，-1表示不衰减
+    double _half_life;   // 半衰期(秒)
+    double _decay_base;  // 基准时间，存储的值 = 当前的值 * 2^((now - _decay_base)/_half_life)
+    double _decay_clock; // set_time设置的时间，0表示使用系统时间
+
+    bool   _stat_on; // 是否开启运行统计
+    stat_t _stat;    // 运行统计
+
+    lsaver _saver; // 后台保存
 
     // LUA_NUMBER
     // LUA_INTEGER
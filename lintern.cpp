@@ -0,0 +1,131 @@
+#include "lintern.hpp"
+
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+
+#define DEFAULT_BUCKET 64
+
+lintern::~lintern()
+{
+    for ( size_t i = 0;i < _size;i ++ )
+    {
+        entry_t *e = _bucket[i];
+        while ( e )
+        {
+            entry_t *next = e->_next;
+            delete [](char *)e;
+
+            e = next;
+        }
+    }
+
+    delete []_bucket;
+    _bucket = NULL;
+}
+
+lintern::lintern()
+{
+    _count  = 0;
+    _size   = 0;
+    _bucket = NULL;
+}
+
+/* FNV-1a */
+size_t lintern::hash( const char *str,size_t sz )
+{
+    size_t h = 2166136261u;
+    for ( size_t i = 0;i < sz;i ++ )
+    {
+        h ^= (unsigned char)str[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+lintern::entry_t *lintern::to_entry( const char *str )
+{
+    return (entry_t *)( str - offsetof(entry_t,_str) );
+}
+
+void lintern::rehash( size_t size )
+{
+    entry_t **bucket = new entry_t*[size];
+    memset( bucket,0,sizeof(entry_t *)*size );
+
+    for ( size_t i = 0;i < _size;i ++ )
+    {
+        entry_t *e = _bucket[i];
+        while ( e )
+        {
+            entry_t *next = e->_next;
+
+            size_t index = e->_hash & (size - 1);
+            e->_next = bucket[index];
+            bucket[index] = e;
+
+            e = next;
+        }
+    }
+
+    delete []_bucket;
+    _bucket = bucket;
+    _size   = size;
+}
+
+const char *lintern::acquire( const char *str,size_t sz )
+{
+    size_t h = hash( str,sz );
+    if ( _size > 0 )
+    {
+        entry_t *e = _bucket[h & (_size - 1)];
+        for ( ;e;e = e->_next )
+        {
+            if ( e->_hash == h && e->_len == sz && 0 == memcmp( e->_str,str,sz ) )
+            {
+                e->_ref ++;
+                return e->_str;
+            }
+        }
+    }
+
+    if ( _count >= _size ) rehash( _size > 0 ? _size*2 : DEFAULT_BUCKET );
+
+    entry_t *e = (entry_t *)new char[offsetof(entry_t,_str) + sz + 1];
+    e->_hash = h;
+    e->_len  = sz;
+    e->_ref  = 1;
+    memcpy( e->_str,str,sz );
+    e->_str[sz] = '\0';
+
+    size_t index = h & (_size - 1);
+    e->_next = _bucket[index];
+    _bucket[index] = e;
+
+    _count ++;
+    return e->_str;
+}
+
+void lintern::release( const char *str )
+{
+    entry_t *e = to_entry( str );
+
+    assert( e->_ref > 0 );
+    if ( --e->_ref > 0 ) return;
+
+    entry_t **link = &_bucket[e->_hash & (_size - 1)];
+    while ( *link != e ) link = &((*link)->_next);
+
+    *link = e->_next;
+    delete [](char *)e;
+
+    _count --;
+}
+
+void lintern::swap( lintern &other )
+{
+    std::swap( _count,other._count );
+    std::swap( _size,other._size );
+    std::swap( _bucket,other._bucket );
+}
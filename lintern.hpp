@@ -0,0 +1,45 @@
+#ifndef __LINTERN_H__
+#define __LINTERN_H__
+
+#include <cstddef>
+
+/* 字符串常量池
+ * 相同内容的字符串只保存一份，使用引用计数管理，引用为0时释放
+ */
+class lintern
+{
+public:
+    ~lintern();
+    explicit lintern();
+
+    // 获取一个字符串，不存在则创建。返回的指针在release之前一直有效
+    const char *acquire( const char *str,size_t sz );
+    // 释放acquire返回的字符串
+    void release( const char *str );
+
+    // 交换两个常量池的内容
+    void swap( lintern &other );
+
+    // 字符串数量
+    inline size_t size() const { return _count; }
+private:
+    typedef struct entry
+    {
+        struct entry *_next;
+        size_t _hash;
+        size_t _len;
+        int    _ref;
+        char   _str[1];
+    }entry_t;
+
+    static size_t hash( const char *str,size_t sz );
+    static entry_t *to_entry( const char *str );
+
+    void rehash( size_t size );
+private:
+    size_t _count;
+    size_t _size;  // 桶数量，2^n
+    entry_t **_bucket;
+};
+
+#endif /* __LINTERN_H__ */
@@ -0,0 +1,146 @@
+#include "lkmap.hpp"
+
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+
+lkmap::~lkmap()
+{
+    delete []_slot;
+
+    _slot  = NULL;
+    _size  = 0;
+    _count = 0;
+}
+
+lkmap::lkmap()
+{
+    _count = 0;
+    _size  = 0;
+    _slot  = NULL;
+}
+
+/* murmur3的fmix64，连续的key也能均匀分布 */
+size_t lkmap::hash( int64_t key )
+{
+    uint64_t h = (uint64_t)key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return (size_t)h;
+}
+
+size_t lkmap::locate( int64_t key ) const
+{
+    size_t mask  = _size - 1;
+    size_t index = hash( key ) & mask;
+    while ( _slot[index]._value && _slot[index]._key != key )
+    {
+        index = ( index + 1 ) & mask;
+    }
+
+    return index;
+}
+
+void lkmap::rehash( size_t size )
+{
+    slot_t *slot = _slot;
+    size_t  old  = _size;
+
+    _slot = new slot_t[size];
+    _size = size;
+    memset( _slot,0,sizeof(slot_t)*size );
+
+    for ( size_t i = 0;i < old;i ++ )
+    {
+        if ( !slot[i]._value ) continue;
+
+        _slot[locate( slot[i]._key )] = slot[i];
+    }
+
+    delete []slot;
+}
+
+void *lkmap::find( int64_t key ) const
+{
+    if ( 0 == _count ) return NULL;
+
+    return _slot[locate( key )]._value;
+}
+
+void lkmap::set( int64_t key,void *value )
+{
+    assert( value );
+
+    // 负载不超过3/4
+    if ( ( _count + 1 )*4 > _size*3 )
+    {
+        rehash( _size ? _size*2 : MIN_SIZE );
+    }
+
+    slot_t &slot = _slot[locate( key )];
+    if ( !slot._value ) _count ++;
+
+    slot._key   = key;
+    slot._value = value;
+}
+
+void *lkmap::erase( int64_t key )
+{
+    if ( 0 == _count ) return NULL;
+
+    size_t mask  = _size - 1;
+    size_t index = locate( key );
+
+    void *value = _slot[index]._value;
+    if ( !value ) return NULL;
+
+    // 把后面探测链上的元素往前移到空出的位置，直到遇到空位置
+    // 元素离理想位置的距离不小于空位置离它的距离时才能移动
+    size_t next = index;
+    for ( ;; )
+    {
+        next = ( next + 1 ) & mask;
+        if ( !_slot[next]._value ) break;
+
+        size_t ideal = hash( _slot[next]._key ) & mask;
+        if ( ( ( next - ideal ) & mask ) >= ( ( next - index ) & mask ) )
+        {
+            _slot[index] = _slot[next];
+            index = next;
+        }
+    }
+    _slot[index]._value = NULL;
+
+    // 负载低于1/8时缩小
+    if ( --_count*8 < _size && _size > MIN_SIZE ) rehash( _size/2 );
+
+    return value;
+}
+
+void lkmap::reserve( size_t size )
+{
+    size_t need = MIN_SIZE;
+    while ( need*3 < size*4 ) need *= 2;
+
+    if ( need > _size ) rehash( need );
+}
+
+void lkmap::clear()
+{
+    delete []_slot;
+
+    _slot  = NULL;
+    _size  = 0;
+    _count = 0;
+}
+
+void lkmap::swap( lkmap &other )
+{
+    std::swap( _count,other._count );
+    std::swap( _size,other._size );
+    std::swap( _slot,other._slot );
+}
@@ -0,0 +1,51 @@
+#ifndef __LKMAP_H__
+#define __LKMAP_H__
+
+#include <cstddef>
+#include <stdint.h>
+
+/* key为整数的哈希表(开放寻址，线性探测)
+ * 所有数据存放在一个连续数组中，查找通常只需要访问一次内存，也不需要为每个
+ * key分配节点。删除时把后面的元素往前移(backward shift)，不需要墓碑
+ * value不能为NULL，NULL表示空位置
+ */
+class lkmap
+{
+public:
+    ~lkmap();
+    explicit lkmap();
+
+    // 查找key，不存在返回NULL
+    void *find( int64_t key ) const;
+    // 设置key的value，已存在则替换
+    void set( int64_t key,void *value );
+    // 删除key，返回原来的value，不存在返回NULL
+    void *erase( int64_t key );
+
+    // 预留size个元素的空间，避免插入时多次扩容
+    void reserve( size_t size );
+    void clear();
+    // 交换两个哈希表的内容
+    void swap( lkmap &other );
+
+    inline size_t size() const { return _count; }
+private:
+    typedef struct
+    {
+        int64_t _key;
+        void   *_value;
+    }slot_t;
+
+    const static size_t MIN_SIZE = 16;
+
+    static size_t hash( int64_t key );
+    // 查找key所在的位置，不存在则返回应该插入的空位置
+    size_t locate( int64_t key ) const;
+    void rehash( size_t size );
+private:
+    size_t  _count;
+    size_t  _size;  // 数组大小，2^n
+    slot_t *_slot;
+};
+
+#endif /* __LKMAP_H__ */
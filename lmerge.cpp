@@ -0,0 +1,155 @@
+#include "lmerge.hpp"
+
+#include <algorithm>
+#include <queue>
+
+/* 优先队列的对比函数，排在前面的元素优先出队 */
+struct lmerge::cursor_less
+{
+    bool operator()( const cursor_t &a,const cursor_t &b ) const
+    {
+        int cmp = lir::compare( a._element->_factor,b._element->_factor );
+        if ( 0 != cmp ) return cmp < 0;
+
+        return a._shard > b._shard;
+    }
+};
+
+lmerge::~lmerge()
+{
+    _shards.clear();
+}
+
+lmerge::lmerge()
+{
+}
+
+void lmerge::add( lir *shard )
+{
+    _shards.push_back( shard );
+}
+
+int lmerge::check()
+{
+    for ( size_t i = 0;i < _shards.size();i ++ )
+    {
+        if ( _shards[i]->is_decay() ) return 24;
+    }
+
+    return 0;
+}
+
+int lmerge::size()
+{
+    int sz = 0;
+    for ( size_t i = 0;i < _shards.size();i ++ ) sz += _shards[i]->size();
+
+    return sz;
+}
+
+/* k路归并，每个排行一个游标，O(nlogk) */
+int lmerge::top( int n,std::vector<lir::key_t> &keys,std::vector<int> &shards )
+{
+    std::priority_queue< cursor_t,std::vector<cursor_t>,cursor_less > heap;
+    for ( size_t i = 0;i < _shards.size();i ++ )
+    {
+        const lir::element_t *element = _shards[i]->seek( 0 );
+        if ( !element ) continue;
+
+        cursor_t cursor;
+        cursor._element = element;
+        cursor._index   = 0;
+        cursor._shard   = (int)i;
+        heap.push( cursor );
+    }
+
+    int cnt = 0;
+    while ( cnt < n && !heap.empty() )
+    {
+        cursor_t cursor = heap.top();
+        heap.pop();
+
+        keys.push_back( cursor._element->_key );
+        shards.push_back( cursor._shard );
+        cnt ++;
+
+        lir *shard = _shards[cursor._shard];
+        cursor._element = shard->next( cursor._element,cursor._index ++ );
+        if ( cursor._element ) heap.push( cursor );
+    }
+
+    return cnt;
+}
+
+/* 元素在全服的排名随它在所在排行中的排名递增，在每个排行中二分查找全服排名
+ * 为index的元素，每次计算全服排名需要在其他排行中二分，O(k^2(logn)^2)，和index无关
+ */
+int lmerge::get_key( int index,lir::key_t &key )
+{
+    if ( index < 0 || index >= size() ) return -1;
+
+    for ( int shard = 0;shard < (int)_shards.size();shard ++ )
+    {
+        // 全服排名不小于所在排行中的排名
+        int lo = 0;
+        int hi = std::min( _shards[shard]->size(),index + 1 );
+        while ( lo < hi )
+        {
+            int mid = lo + ( hi - lo )/2;
+            if ( global_index( shard,mid ) < index )
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+
+        if ( lo < _shards[shard]->size() && global_index( shard,lo ) == index )
+        {
+            key = _shards[shard]->seek( lo )->_key;
+            return shard;
+        }
+    }
+
+    return -1;
+}
+
+/* 所在排行的排名，加上其他排行中排在它前面的元素数量(二分查找)，O(klogn) */
+int lmerge::get_position( lir::key_t key,int &shard )
+{
+    int pos = 0;
+    for ( shard = 0;shard < (int)_shards.size();shard ++ )
+    {
+        pos = _shards[shard]->get_position( key );
+        if ( pos > 0 ) break;
+    }
+    if ( pos <= 0 ) return 0;
+
+    lir::factor_t *factor = NULL;
+    _shards[shard]->get_factor( key,&factor );
+
+    return pos + count_before( shard,factor );
+}
+
+int lmerge::count_before( int shard,const lir::factor_t *factor )
+{
+    int cnt = 0;
+    for ( int i = 0;i < (int)_shards.size();i ++ )
+    {
+        if ( i == shard ) continue;
+
+        // 排序因子相同时，前面的排行排在前面
+        cnt += _shards[i]->count_better( factor,i < shard );
+    }
+
+    return cnt;
+}
+
+int lmerge::global_index( int shard,int index )
+{
+    const lir::element_t *element = _shards[shard]->seek( index );
+
+    return index + count_before( shard,element->_factor );
+}
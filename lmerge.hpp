@@ -0,0 +1,52 @@
+#ifndef __LMERGE_H__
+#define __LMERGE_H__
+
+#include <vector>
+
+#include "linsertion_ranking.hpp"
+
+/* 多个排行(分服、分区)合并后的全服排行视图
+ * 不拷贝任何元素，查询时直接在各个排行上做k路归并或者计数，各个排行仍然
+ * 独立更新。排序因子相同时，前面的排行排在前面
+ * 衰减模式的排行存储的是相对各自基准时间的值，不能直接比较，所以不能合并
+ */
+class lmerge
+{
+public:
+    ~lmerge();
+    explicit lmerge();
+
+    // 添加一个排行，lmerge不负责释放
+    void add( lir *shard );
+
+    // 检查所有排行是否能合并，返回错误码
+    int check();
+
+    // 所有排行的元素数量
+    int size();
+
+    // 根据全服排名获取key，index从0开始。返回所在排行的下标，不存在返回-1
+    int get_key( int index,lir::key_t &key );
+    // 根据key获取全服排名，从1开始，不存在返回0
+    int get_position( lir::key_t key,int &shard );
+    // 全服排名[0,n)的key及所在排行，返回数量
+    int top( int n,std::vector<lir::key_t> &keys,std::vector<int> &shards );
+private:
+    typedef struct
+    {
+        const lir::element_t *_element;
+        int _index; // 元素在所在排行中的排名，从0开始
+        int _shard;
+    }cursor_t;
+
+    struct cursor_less;
+
+    // 其他排行中排在shard的factor前面的元素数量
+    int count_before( int shard,const lir::factor_t *factor );
+    // shard中排名为index(从0开始)的元素的全服排名，从0开始
+    int global_index( int shard,int index );
+
+    std::vector<lir *> _shards;
+};
+
+#endif /* __LMERGE_H__ */
@@ -0,0 +1,67 @@
+#include "lpool.hpp"
+
+#include <cassert>
+#include <algorithm>
+
+lpool::~lpool()
+{
+    for ( size_t i = 0;i < _chunks.size();i ++ )
+    {
+        delete []_chunks[i];
+    }
+
+    _chunks.clear();
+    _free = NULL;
+}
+
+lpool::lpool( size_t size,size_t chunk_size )
+{
+    // 至少能放下一个指针，并按8字节对齐
+    if ( size < sizeof(node_t) ) size = sizeof(node_t);
+    _size  = ( size + 7 ) & ~(size_t)7;
+
+    _count = chunk_size / _size;
+    if ( _count < 1 ) _count = 1;
+
+    _free  = NULL;
+}
+
+void *lpool::alloc()
+{
+    if ( !_free )
+    {
+        char *chunk = new char[_size*_count];
+        _chunks.push_back( chunk );
+
+        // 倒序加入空闲链表，这样分配时是按地址顺序的
+        for ( size_t i = _count;i > 0;i -- )
+        {
+            node_t *node = (node_t *)( chunk + _size*(i - 1) );
+            node->_next  = _free;
+            _free        = node;
+        }
+    }
+
+    node_t *node = _free;
+    _free = node->_next;
+
+    return node;
+}
+
+void lpool::free( void *ptr )
+{
+    if ( !ptr ) return;
+
+    node_t *node = (node_t *)ptr;
+    node->_next  = _free;
+    _free        = node;
+}
+
+void lpool::swap( lpool &other )
+{
+    assert( _size == other._size );
+
+    std::swap( _count,other._count );
+    std::swap( _free,other._free );
+    _chunks.swap( other._chunks );
+}
@@ -0,0 +1,42 @@
+#ifndef __LPOOL_H__
+#define __LPOOL_H__
+
+#include <cstddef>
+#include <vector>
+
+/* 固定大小的内存池
+ * 按块(chunk)向系统申请内存，释放的对象放到空闲链表中重复使用，
+ * 只在内存池销毁时才把所有块一次性归还系统
+ */
+class lpool
+{
+public:
+    ~lpool();
+    explicit lpool( size_t size,size_t chunk_size = DEFAULT_CHUNK );
+
+    void *alloc();
+    void  free( void *ptr );
+
+    // 交换两个内存池的内容，对象大小必须相同
+    void swap( lpool &other );
+
+    // 对象大小
+    inline size_t size() const { return _size; }
+    // 已申请的块数量
+    inline size_t chunk_count() const { return _chunks.size(); }
+private:
+    const static size_t DEFAULT_CHUNK = 64*1024; // 每次申请的块大小
+
+    typedef struct node
+    {
+        struct node *_next;
+    }node_t;
+
+    size_t _size;  // 对象大小
+    size_t _count; // 每个块包含的对象数量
+
+    node_t *_free; // 空闲链表
+    std::vector<char *> _chunks;
+};
+
+#endif /* __LPOOL_H__ */
@@ -0,0 +1,154 @@
+#include "linsertion_ranking.hpp"
+
+#include <cmath>
+#include <ctime>
+#include <algorithm>
+
+/* 衰减模式
+ * 排序因子随时间指数衰减，但所有元素按同样的比例衰减，排名不会变化。因此
+ * 存储的是归一化到基准时间的值：存储的值 = 当前的值 * 2^((now - base)/half_life)，
+ * 只有更新时需要转换，不需要定时更新所有元素
+ * 存储的值随时间指数增长，超过2^DECAY_REBASE倍时把基准时间后移整数个半衰期，
+ * 所有元素乘以2的负整数次幂，只修改指数位，大小关系不变。只有更新时才会重设，
+ * 查询时的转换(decay_scale)不修改排行
+ * 变更日志中记录的是存储的值，重放时不需要转换。重设基准时间后下次保存写完整文件
+ */
+
+static bool factor_greater( const lir::element_t *a,const lir::element_t *b )
+{
+    return lir::compare( a->_factor,b->_factor ) > 0;
+}
+
+int lir::set_decay( double half_life,int index )
+{
+    if ( 0 != _cur_size ) return 21;
+    if ( half_life > 0 && _packed ) return 22;
+    if ( half_life < 0 || index < 1 || index > MAX_FACTOR ) return 23;
+
+    _decay_index = half_life > 0 ? index - 1 : -1;
+    _half_life   = half_life;
+    _decay_base  = half_life > 0 ? decay_now() : 0;
+
+    return 0;
+}
+
+void lir::set_time( double now )
+{
+    _decay_clock = now > 0 ? now : 0;
+}
+
+double lir::decay_now()
+{
+    return _decay_clock > 0 ? _decay_clock : (double)::time( NULL );
+}
+
+lir::factor_t lir::decay_in( factor_t factor,int index )
+{
+    if ( index != _decay_index ) return factor;
+
+    double now = decay_now();
+    if ( now - _decay_base >= DECAY_REBASE*_half_life ) decay_rebase( now );
+
+    return decay_scale( factor,index );
+}
+
+void lir::decay_in( factor_t *factor )
+{
+    if ( _decay_index < 0 ) return;
+
+    factor[_decay_index] = decay_in( factor[_decay_index],_decay_index );
+}
+
+/* 很久没有更新时2的幂可能溢出为无穷大，0仍然转换为0 */
+lir::factor_t lir::decay_scale( factor_t factor,int index )
+{
+    if ( index != _decay_index || 0 == factor ) return factor;
+
+    return factor*std::pow( 2.0,( decay_now() - _decay_base )/_half_life );
+}
+
+void lir::decay_scale( factor_t *factor )
+{
+    if ( _decay_index < 0 ) return;
+
+    factor[_decay_index] = decay_scale( factor[_decay_index],_decay_index );
+}
+
+lir::factor_t lir::decay_out( factor_t factor,int index )
+{
+    if ( index != _decay_index ) return factor;
+
+    return factor*std::pow( 2.0,( _decay_base - decay_now() )/_half_life );
+}
+
+/* 基准时间后移k个半衰期，所有元素的值乘以2^-k
+ * 极小的值可能下溢为0，和其他值相等后顺序由后面的排序因子决定，此时重新排序，
+ * 排名变化的元素记录到变更记录、排名事件中
+ */
+void lir::decay_rebase( double now )
+{
+    int k = (int)std::floor( ( now - _decay_base )/_half_life );
+    if ( k <= 0 ) return;
+
+    _decay_base += k*_half_life;
+    _modify  = true;
+    _compact = true; // 日志中的值是旧基准时间的，必须写完整文件
+
+    std::vector<element_t *> elements;
+    std::vector<tnode_t *>   nodes;
+    elements.reserve( _cur_size );
+    if ( BK_TREE == _backend ) nodes.reserve( _cur_size );
+
+    bool sorted = true;
+    element_t *element = seek( 0 );
+    for ( int i = 0;element;element = next( element,i ++ ) )
+    {
+        factor_t &factor = element->_factor[_decay_index];
+        factor = std::ldexp( factor,-k );
+
+        if ( i > 0 && compare( elements[i - 1],element ) < 0 ) sorted = false;
+
+        element->_pos = i + 1; // 重新排序前的排名
+        elements.push_back( element );
+        if ( BK_TREE == _backend ) nodes.push_back( element->_node );
+    }
+
+    if ( !sorted )
+    {
+        std::stable_sort( elements.begin(),elements.end(),factor_greater );
+    }
+
+    std::vector<element_t *> moved;
+    std::vector<int> old_pos;
+    std::vector<int> new_pos;
+
+    // 树的形状只和排名有关，按中序把元素重新放到原来的节点上
+    for ( int i = 0;i < (int)elements.size();i ++ )
+    {
+        element = elements[i];
+        if ( element->_pos != i + 1 )
+        {
+            moved.push_back( element );
+            old_pos.push_back( element->_pos );
+            new_pos.push_back( i + 1 );
+        }
+
+        if ( BK_TREE == _backend )
+        {
+            nodes[i]->_element = element;
+            element->_node     = nodes[i];
+            make_key( nodes[i]->_skey,element->_factor );
+        }
+        else
+        {
+            element->_pos = i + 1;
+            place( i,element );
+        }
+    }
+
+    if ( _watch_cap > 0 && !moved.empty() ) watch_bulk( moved,old_pos,new_pos );
+    for ( size_t k = 0;k < moved.size();k ++ )
+    {
+        track( moved[k],old_pos[k],new_pos[k],true );
+    }
+}
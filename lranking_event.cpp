@@ -0,0 +1,265 @@
+#include "linsertion_ranking.hpp"
+
+#include <algorithm>
+
+/* 排名事件
+ * 排名变化时产生事件，放到环形缓冲区中，由逻辑层批量取出，不需要轮询
+ * get_position。缓冲区满时覆盖最旧的事件，并记录丢弃的数量
+ * EV_MOVE只记录_watch_top以内的排名变化，EV_ENTER、EV_LEAVE记录元素进入、
+ * 离开阈值，包括被挤出阈值或者补进阈值的元素
+ */
+
+int lir::set_watch( int capacity,const int *thresholds,int cnt )
+{
+    if ( cnt > MAX_THRESHOLD ) return 1;
+
+    _watch_cap = capacity > 0 ? capacity : 0;
+    _th_cnt    = 0;
+    _watch_top = 0;
+    for ( int i = 0;i < cnt;i ++ )
+    {
+        if ( thresholds[i] > 0 ) _thresholds[_th_cnt ++] = thresholds[i];
+    }
+    std::sort( _thresholds,_thresholds + _th_cnt );
+    _th_cnt = (int)( std::unique( _thresholds,_thresholds + _th_cnt ) - _thresholds );
+    if ( _th_cnt > 0 ) _watch_top = _thresholds[_th_cnt - 1];
+
+    _ev_head    = 0;
+    _ev_cnt     = 0;
+    _ev_dropped = 0;
+    _events.clear();
+    _events.resize( _watch_cap );
+
+    return 0;
+}
+
+void lir::push_event( int type,key_t key,key_t other,int from,int to,int rank )
+{
+    int index = ( _ev_head + _ev_cnt ) % _watch_cap;
+    if ( _ev_cnt >= _watch_cap )
+    {
+        _ev_dropped ++;
+        _ev_head = ( _ev_head + 1 ) % _watch_cap;
+    }
+    else
+    {
+        _ev_cnt ++;
+    }
+
+    event_t &ev = _events[index];
+    ev._type  = type;
+    ev._key   = key;
+    ev._other = other;
+    ev._from  = from;
+    ev._to    = to;
+    ev._rank  = rank;
+}
+
+/* 元素排名从old_pos变为new_pos(old_pos为0表示新元素)，排名已经更新 */
+void lir::watch( element_t *element,int old_pos,int new_pos )
+{
+    if ( old_pos == new_pos ) return;
+
+    key_t key = element->_key;
+    bool  up  = old_pos <= 0 || new_pos < old_pos;
+
+    if ( 0 == _watch_top || new_pos <= _watch_top
+        || ( old_pos > 0 && old_pos <= _watch_top ) )
+    {
+        push_event( EV_MOVE,key,watch_other( old_pos,new_pos ),old_pos,new_pos,0 );
+    }
+
+    for ( int i = 0;i < _th_cnt;i ++ )
+    {
+        int rank = _thresholds[i];
+        if ( up )
+        {
+            // 进入阈值，原来的第rank名被挤出
+            if ( new_pos > rank ) continue;
+            if ( old_pos > 0 && old_pos <= rank ) break;
+
+            push_event( EV_ENTER,key,0,old_pos,new_pos,rank );
+            if ( rank < _cur_size )
+            {
+                push_event( EV_LEAVE,seek( rank )->_key,key,rank,rank + 1,rank );
+            }
+        }
+        else
+        {
+            // 离开阈值，原来的第rank + 1名补进来
+            if ( old_pos > rank ) continue;
+            if ( new_pos <= rank ) break;
+
+            push_event( EV_LEAVE,key,0,old_pos,new_pos,rank );
+            push_event( EV_ENTER,seek( rank - 1 )->_key,key,rank + 1,rank,rank );
+        }
+    }
+}
+
+/* 排名从old_pos变为new_pos的元素超越的元素(上升)或者超越它的元素(下降)
+ * 上升时，原来在new_pos的元素被挤到new_pos + 1
+ * 下降时，超越了该元素的元素现在在new_pos - 1
+ */
+lir::key_t lir::watch_other( int old_pos,int new_pos )
+{
+    element_t *other = NULL;
+    if ( old_pos <= 0 || new_pos < old_pos )
+    {
+        if ( new_pos < _cur_size ) other = seek( new_pos );
+    }
+    else if ( new_pos > 1 )
+    {
+        other = seek( new_pos - 2 );
+    }
+
+    return other ? other->_key : 0;
+}
+
+/* 未移动的元素中第u(从1开始)个的排名。pos为移动的元素占用的排名，升序
+ * u递增调用，index为已跳过的pos数量，初始为0
+ */
+static int unmoved_pos( const std::vector<int> &pos,int u,size_t &index )
+{
+    int p = u + (int)index;
+    while ( index < pos.size() && pos[index] <= p )
+    {
+        index ++;
+        p ++;
+    }
+
+    return p;
+}
+
+/* 批量更新后计算排名事件，排名已经更新
+ * moved为排名可能变化的元素，old_pos、new_pos为其更新前、后的排名(old_pos为0表示
+ * 新元素)，其他元素之间的相对顺序不变。移动的元素对比前后排名得到进入、离开阈值
+ * 的事件。未移动的元素在阈值内的数量 = 阈值 - 阈值内移动的元素数量，按相对顺序
+ * 就能找到被挤出、补进阈值的元素。多个元素同时变化时，被挤出、补进的原因不确定，
+ * 这些事件的_other为0
+ */
+void lir::watch_bulk( const std::vector<element_t *> &moved,
+    const std::vector<int> &old_pos,const std::vector<int> &new_pos )
+{
+    std::vector<int> old_sorted;
+    std::vector<int> new_sorted( new_pos );
+    for ( size_t k = 0;k < moved.size();k ++ )
+    {
+        if ( old_pos[k] > 0 ) old_sorted.push_back( old_pos[k] );
+    }
+    std::sort( old_sorted.begin(),old_sorted.end() );
+    std::sort( new_sorted.begin(),new_sorted.end() );
+
+    int old_size = _cur_size - (int)( moved.size() - old_sorted.size() );
+
+    for ( size_t k = 0;k < moved.size();k ++ )
+    {
+        int from = old_pos[k];
+        int to   = new_pos[k];
+        if ( from == to ) continue;
+
+        if ( 0 == _watch_top || to <= _watch_top
+            || ( from > 0 && from <= _watch_top ) )
+        {
+            push_event( EV_MOVE,moved[k]->_key,watch_other( from,to ),from,to,0 );
+        }
+    }
+
+    for ( int i = 0;i < _th_cnt;i ++ )
+    {
+        int rank = _thresholds[i];
+
+        int old_in = 0;
+        int new_in = 0;
+        for ( size_t k = 0;k < moved.size();k ++ )
+        {
+            bool was = old_pos[k] > 0 && old_pos[k] <= rank;
+            bool is  = new_pos[k] <= rank;
+            if ( was ) old_in ++;
+            if ( is  ) new_in ++;
+
+            if ( is && !was )
+            {
+                push_event( EV_ENTER,moved[k]->_key,0,old_pos[k],new_pos[k],rank );
+            }
+            else if ( was && !is )
+            {
+                push_event( EV_LEAVE,moved[k]->_key,0,old_pos[k],new_pos[k],rank );
+            }
+        }
+
+        // 未移动的元素在阈值内的数量，前后不一样则中间的被挤出或者补进
+        int before = std::min( rank,old_size  ) - old_in;
+        int after  = std::min( rank,_cur_size ) - new_in;
+        int type   = after < before ? EV_LEAVE : EV_ENTER;
+
+        size_t old_index = 0;
+        size_t new_index = 0;
+        for ( int u = std::min( before,after ) + 1;u <= std::max( before,after );u ++ )
+        {
+            int from = unmoved_pos( old_sorted,u,old_index );
+            int to   = unmoved_pos( new_sorted,u,new_index );
+
+            push_event( type,seek( to - 1 )->_key,0,from,to,rank );
+        }
+    }
+}
+
+/* 排名为pos的元素将被删除，此时还在排行中 */
+void lir::watch_del( key_t key,int pos )
+{
+    if ( 0 == _watch_top || pos <= _watch_top )
+    {
+        push_event( EV_MOVE,key,0,pos,0,0 );
+    }
+
+    for ( int i = 0;i < _th_cnt;i ++ )
+    {
+        int rank = _thresholds[i];
+        if ( pos > rank ) continue;
+
+        push_event( EV_LEAVE,key,0,pos,0,rank );
+        if ( rank < _cur_size )
+        {
+            push_event( EV_ENTER,seek( rank )->_key,key,rank + 1,rank,rank );
+        }
+    }
+}
+
+/* 排行被清空(rollover)，阈值内的元素都离开阈值，O(最大阈值)
+ * 清空不是逐个删除，不记录EV_MOVE
+ */
+void lir::watch_clear()
+{
+    int n = std::min( _watch_top,_cur_size );
+
+    element_t *element = seek( 0 );
+    for ( int index = 0;index < n;element = next( element,index ++ ) )
+    {
+        for ( int i = 0;i < _th_cnt;i ++ )
+        {
+            int rank = _thresholds[i];
+            if ( index + 1 > rank ) continue;
+
+            push_event( EV_LEAVE,element->_key,0,index + 1,0,rank );
+        }
+    }
+}
+
+int lir::get_events( std::vector<event_t> &events,int max,int64_t &dropped )
+{
+    int cnt = _ev_cnt;
+    if ( max > 0 && max < cnt ) cnt = max;
+
+    for ( int i = 0;i < cnt;i ++ )
+    {
+        events.push_back( _events[( _ev_head + i ) % _watch_cap] );
+    }
+
+    _ev_head = cnt > 0 ? ( _ev_head + cnt ) % _watch_cap : _ev_head;
+    _ev_cnt -= cnt;
+
+    dropped     = _ev_dropped;
+    _ev_dropped = 0;
+
+    return cnt;
+}
@@ -0,0 +1,296 @@
+#include "linsertion_ranking.hpp"
+
+#include <cerrno>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* 变更日志
+ * 开启后每次更新都把参数记录到_jpending，save时作为一个批次追加到<path>.jnl，
+ * 只有日志超过完整文件大小(至少JOURNAL_MIN)时才重写完整文件，并开始一个新的日志
+ * 加载时先加载完整文件，再按顺序重放代数相同的日志。日志中的更新是确定的，
+ * 批量更新按记录的方式重放，和加载时的set_watch、set_max_size等设置无关，
+ * 重放后和保存前的排行一致
+ */
+
+void lir::set_journal( bool on )
+{
+    _journal_on = on;
+    if ( !on ) _jpending.clear();
+}
+
+const char *lir::journal_path( std::string &path )
+{
+    path  = _path;
+    path += ".jnl";
+
+    return path.c_str();
+}
+
+void lir::journal_header( lbuffer &buffer )
+{
+    journal_header_t header;
+    memset( &header,0,sizeof(header) );
+
+    header._magic      = JOURNAL_MAGIC;
+    header._version    = JOURNAL_VERSION;
+    header._generation = _generation;
+
+    buffer.append( &header,sizeof(header) );
+}
+
+void lir::journal_factor( key_t key,const factor_t *factor,int cnt )
+{
+    if ( !_journal_on ) return;
+
+    unsigned char op = JOP_FACTOR;
+    _jpending.append( &op,sizeof(op) );
+    _jpending.append_zigzag( key );
+    _jpending.append_varint( cnt );
+    _jpending.append( factor,sizeof(factor_t)*cnt );
+}
+
+void lir::journal_one_factor( key_t key,factor_t factor,int index )
+{
+    if ( !_journal_on ) return;
+
+    unsigned char op = JOP_ONE_FACTOR;
+    _jpending.append( &op,sizeof(op) );
+    _jpending.append_zigzag( key );
+    _jpending.append_varint( index );
+    _jpending.append( &factor,sizeof(factor) );
+}
+
+void lir::journal_value( key_t key,int index,const lval_t &lval )
+{
+    if ( !_journal_on ) return;
+
+    unsigned char op = JOP_VALUE;
+    _jpending.append( &op,sizeof(op) );
+    _jpending.append_zigzag( key );
+    encode_value( _jpending,index,lval );
+}
+
+void lir::journal_del( key_t key )
+{
+    if ( !_journal_on ) return;
+
+    unsigned char op = JOP_DEL;
+    _jpending.append( &op,sizeof(op) );
+    _jpending.append_zigzag( key );
+}
+
+/* 相同排序因子的顺序取决于批量更新的方式，记录在key的位置，保持记录格式一致 */
+void lir::journal_bulk( const update_t *updates,int n,int mode )
+{
+    if ( !_journal_on ) return;
+
+    unsigned char op = JOP_BULK;
+    _jpending.append( &op,sizeof(op) );
+    _jpending.append_zigzag( mode );
+    _jpending.append_varint( n );
+    for ( int i = 0;i < n;i ++ )
+    {
+        _jpending.append_zigzag( updates[i]._key );
+        _jpending.append_varint( updates[i]._cnt );
+        _jpending.append( updates[i]._factor,sizeof(factor_t)*updates[i]._cnt );
+    }
+}
+
+/* 把_jpending作为一个批次追加到日志文件
+ * 返回false表示需要写完整文件：未开启日志、日志不可用或者日志太大
+ */
+bool lir::journal_append()
+{
+    if ( !_journal_on || _compact ) return false;
+
+    size_t max = _base_size > JOURNAL_MIN ? _base_size : JOURNAL_MIN;
+    if ( _journal_size + _jpending.size() > max ) return false;
+
+    if ( 0 == _jpending.size() ) return true;
+
+    uint32_t crc = lcrc32( _jpending.data(),_jpending.size() );
+
+    lbuffer batch( _jpending.size() + 16 );
+    batch.append( &crc,sizeof(crc) );
+    batch.append_varint( _jpending.size() );
+    batch.append( _jpending.data(),_jpending.size() );
+
+    std::string path;
+    int fd = ::open( journal_path( path ),O_WRONLY | O_APPEND );
+    if ( fd < 0 )
+    {
+        _compact = true;
+        return false;
+    }
+
+    const char *data = batch.data();
+    size_t sz = batch.size();
+    while ( sz > 0 )
+    {
+        ssize_t n = ::write( fd,data,sz );
+        if ( n < 0 )
+        {
+            if ( EINTR == errno ) continue;
+            break;
+        }
+
+        data += n;
+        sz   -= n;
+    }
+
+    bool ok = 0 == sz && 0 == ::fsync( fd );
+    ::close( fd );
+
+    // 写入失败时日志末尾可能有不完整的批次，直接写完整文件
+    if ( !ok )
+    {
+        _compact = true;
+        return false;
+    }
+
+    _journal_size += batch.size();
+    _jpending.clear();
+
+    return true;
+}
+
+/* 重放和完整文件代数相同的日志，末尾不完整的批次会被忽略 */
+int lir::journal_replay()
+{
+    _compact = true;
+
+    std::string path;
+    std::vector<char> data;
+    if ( read_file( journal_path( path ),data ) < 0 ) return 0;
+
+    journal_header_t header;
+    if ( data.size() < sizeof(header) ) return 0;
+
+    memcpy( &header,&data[0],sizeof(header) );
+    if ( JOURNAL_MAGIC != header._magic || JOURNAL_VERSION != header._version
+        || _generation != header._generation )
+    {
+        return 0; // 旧的日志，数据已经在完整文件中
+    }
+
+    size_t valid = sizeof(header);
+    lreader reader( &data[0] + valid,data.size() - valid );
+    while ( reader.remain() > 0 )
+    {
+        uint32_t crc = 0;
+        uint64_t len = 0;
+        if ( !reader.read( &crc,sizeof(crc) ) || !reader.read_varint( len )
+            || len > reader.remain() )
+        {
+            break;
+        }
+
+        const char *batch = reader.skip( len );
+        if ( crc != lcrc32( batch,len ) ) break;
+
+        int err = journal_apply( batch,len );
+        if ( err ) return err;
+
+        valid = data.size() - reader.remain();
+    }
+
+    _journal_size = valid;
+    _compact      = valid != data.size();
+
+    return 0;
+}
+
+/* 执行一个批次中的所有变更 */
+int lir::journal_apply( const char *data,size_t sz )
+{
+    lreader reader( data,sz );
+    while ( reader.remain() > 0 )
+    {
+        unsigned char op = 0;
+        int64_t key = 0;
+        if ( !reader.read( &op,sizeof(op) ) || !reader.read_zigzag( key ) )
+        {
+            return 20;
+        }
+
+        int old_pos = 0;
+        switch ( op )
+        {
+            case JOP_FACTOR :
+            {
+                uint64_t cnt = 0;
+                factor_t factor[MAX_FACTOR] = { 0 };
+                if ( !reader.read_varint( cnt ) || cnt > (uint64_t)MAX_FACTOR
+                    || !reader.read( factor,sizeof(factor_t)*cnt ) )
+                {
+                    return 20;
+                }
+                if ( check_factor( factor ) ) return 14;
+
+                update_factor( key,factor,(int)cnt,old_pos );
+            }break;
+            case JOP_ONE_FACTOR :
+            {
+                uint64_t index = 0;
+                factor_t factor = 0;
+                if ( !reader.read_varint( index ) || index < 1 || index > (uint64_t)MAX_FACTOR
+                    || !reader.read( &factor,sizeof(factor) ) )
+                {
+                    return 20;
+                }
+                if ( check_factor( (int)index - 1,factor ) ) return 14;
+
+                update_one_factor( key,factor,(int)index,old_pos );
+            }break;
+            case JOP_VALUE :
+            {
+                int index = 0;
+                lval_t lval;
+                if ( decode_value( reader,index,lval ) ) return 20;
+
+                // 被丢弃的元素(set_max_size)忽略其变量
+                int err = update_one_value( key,index,lval );
+                if ( err && 1 != err ) return 20;
+            }break;
+            case JOP_DEL : del( key );break;
+            case JOP_BULK :
+            {
+                // key为记录时的方式，用同样的方式更新
+                uint64_t n = 0;
+                if ( key < BM_AUTO || key > BM_SHIFT ) return 20;
+                if ( !reader.read_varint( n ) || n > reader.remain() ) return 20;
+
+                std::vector<update_t> updates( n );
+                for ( uint64_t i = 0;i < n;i ++ )
+                {
+                    update_t &update = updates[i];
+                    memset( &update,0,sizeof(update) );
+
+                    int64_t  ukey = 0;
+                    uint64_t cnt  = 0;
+                    if ( !reader.read_zigzag( ukey ) || !reader.read_varint( cnt )
+                        || cnt > (uint64_t)MAX_FACTOR
+                        || !reader.read( update._factor,sizeof(factor_t)*cnt ) )
+                    {
+                        return 20;
+                    }
+                    if ( check_factor( update._factor ) ) return 14;
+
+                    update._key = ukey;
+                    update._cnt = (int)cnt;
+                }
+
+                if ( n > 0 )
+                {
+                    std::vector<int> new_pos( n ),old_pos( n );
+                    update_factors( &updates[0],(int)n,
+                        &new_pos[0],&old_pos[0],(int)key );
+                }
+            }break;
+            default : return 20;
+        }
+    }
+
+    return 0;
+}
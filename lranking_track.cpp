@@ -0,0 +1,131 @@
+#include "linsertion_ranking.hpp"
+
+#include <algorithm>
+
+/* 变更记录
+ * 每个变更的序号为++_seq，同时记录到元素的_ver中。开启记录(set_track)后，
+ * 最近的变更(key及排名变化的范围)保存在_changes中，changes_since只需要
+ * 遍历seq之后的变更，不需要对比整个排行
+ */
+
+void lir::set_track( int capacity )
+{
+    _track_cap = capacity > 0 ? capacity : 0;
+    _track_min = _seq;
+
+    _changes.clear();
+}
+
+/* 元素的排序因子或者变量发生变化，排名从old_pos变为new_pos
+ * old_pos为0表示新元素，new_pos为0表示排名不变
+ * bulk为true时多个元素同时变化，排名事件由watch_bulk统一计算
+ */
+void lir::track( element_t *element,int old_pos,int new_pos,bool bulk )
+{
+    element->_ver = ++_seq;
+    if ( _stat_on && new_pos > 0 )
+    {
+        int moved = old_pos > 0 ? old_pos - new_pos : _cur_size - new_pos;
+        _stat._moved.record( moved < 0 ? -moved : moved );
+    }
+    if ( _watch_cap > 0 && new_pos > 0 && !bulk ) watch( element,old_pos,new_pos );
+    if ( _track_cap <= 0 ) return;
+
+    change_t change;
+    change._seq  = _seq;
+    change._key  = element->_key;
+    if ( new_pos <= 0 )
+    {
+        change._from = 0;
+        change._to   = 0;
+    }
+    else if ( old_pos <= 0 ) // 新元素之后的排名都发生变化
+    {
+        change._from = new_pos;
+        change._to   = _cur_size;
+    }
+    else
+    {
+        change._from = old_pos < new_pos ? old_pos : new_pos;
+        change._to   = old_pos < new_pos ? new_pos : old_pos;
+    }
+
+    _changes.push_back( change );
+    if ( (int)_changes.size() > _track_cap )
+    {
+        _track_min = _changes.front()._seq;
+        _changes.pop_front();
+    }
+}
+
+/* 元素被删除，[from,to]内的元素排名发生变化 */
+void lir::track_del( key_t key,int from,int to )
+{
+    ++_seq;
+    if ( _stat_on ) _stat._moved.record( to - from );
+    if ( _watch_cap > 0 ) watch_del( key,from );
+    if ( _track_cap <= 0 ) return;
+
+    change_t change;
+    change._seq  = _seq;
+    change._key  = key;
+    change._from = from;
+    change._to   = to;
+
+    _changes.push_back( change );
+    if ( (int)_changes.size() > _track_cap )
+    {
+        _track_min = _changes.front()._seq;
+        _changes.pop_front();
+    }
+}
+
+/* 新元素插入到pos，之后的元素排名都发生变化。pos为0表示没有插入 */
+int lir::track_insert( int pos )
+{
+    if ( pos > 0 ) track( seek( pos - 1 ),0,pos );
+
+    return pos;
+}
+
+bool lir::changes_since( int64_t seq,std::vector<key_t> &keys,
+    std::vector<key_t> &deleted,int &from,int &to )
+{
+    from = 0;
+    to   = 0;
+    if ( _track_cap <= 0 || seq < _track_min ) return false;
+
+    std::vector<key_t> changed;
+
+    std::deque<change_t>::reverse_iterator itr = _changes.rbegin();
+    for ( ;itr != _changes.rend() && itr->_seq > seq;itr ++ )
+    {
+        changed.push_back( itr->_key );
+        if ( itr->_from <= 0 ) continue;
+
+        if ( 0 == from || itr->_from < from ) from = itr->_from;
+        if ( itr->_to > to ) to = itr->_to;
+    }
+
+    std::sort( changed.begin(),changed.end() );
+    changed.erase( std::unique( changed.begin(),changed.end() ),changed.end() );
+
+    for ( size_t i = 0;i < changed.size();i ++ )
+    {
+        const element_t *element = (const element_t *)_kmap.find( changed[i] );
+        if ( !element )
+        {
+            deleted.push_back( changed[i] );
+        }
+        else if ( element->_ver > seq )
+        {
+            keys.push_back( changed[i] );
+        }
+    }
+
+    // 排行末尾的元素被删除时，范围可能超出当前排行
+    if ( to > _cur_size ) to = _cur_size;
+    if ( from > to ) from = to = 0;
+
+    return true;
+}
@@ -0,0 +1,291 @@
+#include "linsertion_ranking.hpp"
+
+#include <cassert>
+#include <vector>
+
+/* 顺序统计树(treap)
+ * 中序遍历即为排名顺序，每个节点记录子树大小，用于O(logn)计算排名及按排名查找
+ * 节点有父指针，删除、计算排名时不需要再对比排序因子
+ */
+
+#define node_size(node) ( (node) ? (node)->_size : 0 )
+
+/* 生成treap优先级 */
+static inline unsigned int next_prio( unsigned int &seed )
+{
+    seed ^= seed << 13; // xorshift32
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    return seed;
+}
+
+/* 把node旋转到其父节点的位置 */
+void lir::tree_rotate( tnode_t *node )
+{
+    assert( node->_parent );
+
+    tnode_t *parent = node->_parent;
+    tnode_t *grand  = parent->_parent;
+
+    if ( parent->_left == node )
+    {
+        parent->_left = node->_right;
+        if ( node->_right ) node->_right->_parent = parent;
+
+        node->_right = parent;
+    }
+    else
+    {
+        parent->_right = node->_left;
+        if ( node->_left ) node->_left->_parent = parent;
+
+        node->_left = parent;
+    }
+
+    parent->_parent = node;
+    node->_parent   = grand;
+
+    if ( !grand )
+    {
+        _root = node;
+    }
+    else if ( grand->_left == parent )
+    {
+        grand->_left = node;
+    }
+    else
+    {
+        grand->_right = node;
+    }
+
+    // 只有这两个节点的子树发生了变化
+    parent->_size = node_size( parent->_left ) + node_size( parent->_right ) + 1;
+    node->_size   = node_size( node->_left   ) + node_size( node->_right   ) + 1;
+}
+
+/* 插入节点，返回排名
+ * @shift 排序因子相同时的位置：>0(新增或排名上升)排在相同元素后面，
+ * <0(排名下降)排在相同元素前面，和BK_ARRAY的插入排序保持一致
+ */
+int lir::tree_insert( tnode_t *node,int shift )
+{
+    node->_left   = NULL;
+    node->_right  = NULL;
+    node->_parent = NULL;
+    node->_size   = 1;
+    node->_prio   = next_prio( _seed );
+
+    // 排序因子拷贝到节点中，查找时不需要再访问element
+    make_key( node->_skey,node->_element->_factor );
+
+    tnode_t  *parent = NULL;
+    tnode_t **link   = &_root;
+    while ( *link )
+    {
+        parent = *link;
+        parent->_size ++;
+
+        int cmp = compare_key( &(node->_skey),&(parent->_skey) );
+        if ( cmp > 0 || ( 0 == cmp && shift < 0 ) )
+        {
+            link = &(parent->_left);
+        }
+        else
+        {
+            link = &(parent->_right);
+        }
+    }
+
+    *link = node;
+    node->_parent = parent;
+
+    while ( node->_parent && node->_parent->_prio < node->_prio )
+    {
+        tree_rotate( node );
+    }
+
+    return tree_rank( node );
+}
+
+/* 从树中移除节点，不释放内存 */
+void lir::tree_remove( tnode_t *node )
+{
+    // 旋转到叶子节点再删除
+    while ( node->_left || node->_right )
+    {
+        tnode_t *child = node->_left;
+        if ( !child || ( node->_right && node->_right->_prio > child->_prio ) )
+        {
+            child = node->_right;
+        }
+
+        tree_rotate( child );
+    }
+
+    tnode_t *parent = node->_parent;
+    if ( !parent )
+    {
+        _root = NULL;
+    }
+    else if ( parent->_left == node )
+    {
+        parent->_left = NULL;
+    }
+    else
+    {
+        parent->_right = NULL;
+    }
+
+    for ( ;parent;parent = parent->_parent ) parent->_size --;
+
+    node->_parent = NULL;
+}
+
+/* 节点排名，从1开始 */
+int lir::tree_rank( const tnode_t *node )
+{
+    int rank = node_size( node->_left ) + 1;
+
+    for ( ;node->_parent;node = node->_parent )
+    {
+        if ( node->_parent->_right == node )
+        {
+            rank += node_size( node->_parent->_left ) + 1;
+        }
+    }
+
+    return rank;
+}
+
+/* 根据排名查找节点，index从0开始 */
+lir::tnode_t *lir::tree_select( int index )
+{
+    if ( index < 0 || index >= node_size( _root ) ) return NULL;
+
+    tnode_t *node = _root;
+    while ( node )
+    {
+        int lsz = node_size( node->_left );
+        if ( index < lsz )
+        {
+            node = node->_left;
+        }
+        else if ( index > lsz )
+        {
+            index -= lsz + 1;
+            node = node->_right;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return node;
+}
+
+/* 对比结果compare( element,factor ) >= limit的节点数量，见count_better */
+int lir::tree_count( const factor_t *factor,int limit )
+{
+    int cnt = 0;
+    const tnode_t *node = _root;
+    while ( node )
+    {
+        if ( compare( node->_element->_factor,factor ) >= limit )
+        {
+            cnt += node_size( node->_left ) + 1;
+            node = node->_right;
+        }
+        else
+        {
+            node = node->_left;
+        }
+    }
+
+    return cnt;
+}
+
+/* 中序的下一个节点 */
+lir::tnode_t *lir::tree_next( const tnode_t *node )
+{
+    if ( node->_right )
+    {
+        tnode_t *next = node->_right;
+        while ( next->_left ) next = next->_left;
+
+        return next;
+    }
+
+    while ( node->_parent && node->_parent->_right == node )
+    {
+        node = node->_parent;
+    }
+
+    return node->_parent;
+}
+
+/* 用已排好序的元素构建整棵树，O(n)，不需要对比排序因子
+ * 按顺序加入节点，用栈维护最右链(笛卡尔树)。节点出栈后其子树不会再变化，
+ * 这时计算子树大小
+ */
+void lir::tree_build( element_t **elements,int n )
+{
+    assert( !_root );
+
+    std::vector<tnode_t *> stack;
+    for ( int i = 0;i < n;i ++ )
+    {
+        tnode_t *node = (tnode_t *)_npool.alloc();
+        node->_element   = elements[i];
+        elements[i]->_node = node;
+
+        node->_left   = NULL;
+        node->_right  = NULL;
+        node->_parent = NULL;
+        node->_size   = 1;
+        node->_prio   = next_prio( _seed );
+        make_key( node->_skey,elements[i]->_factor );
+
+        tnode_t *last = NULL;
+        while ( !stack.empty() && stack.back()->_prio < node->_prio )
+        {
+            last = stack.back();
+            last->_size = node_size( last->_left ) + node_size( last->_right ) + 1;
+            stack.pop_back();
+        }
+
+        node->_left = last;
+        if ( last ) last->_parent = node;
+
+        if ( !stack.empty() )
+        {
+            stack.back()->_right = node;
+            node->_parent = stack.back();
+        }
+
+        stack.push_back( node );
+    }
+
+    while ( !stack.empty() )
+    {
+        tnode_t *node = stack.back();
+        node->_size = node_size( node->_left ) + node_size( node->_right ) + 1;
+        stack.pop_back();
+    }
+
+    _root = n > 0 ? elements[0]->_node : NULL;
+    while ( _root && _root->_parent ) _root = _root->_parent;
+}
+
+/* 释放子树所有节点及元素 */
+void lir::tree_free( tnode_t *node )
+{
+    if ( !node ) return;
+
+    tree_free( node->_left  );
+    tree_free( node->_right );
+
+    del_element( node->_element );
+    _npool.free( node );
+}
@@ -0,0 +1,161 @@
+#include "lsaver.hpp"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>       // rename
+
+lsaver::~lsaver()
+{
+    int err = 0;
+    wait( err );
+    clear();
+
+    pthread_mutex_destroy( &_mutex );
+}
+
+lsaver::lsaver()
+{
+    _running  = false;
+    _finished = false;
+    _errno    = 0;
+
+    pthread_mutex_init( &_mutex,NULL );
+}
+
+void lsaver::add( const char *path,lbuffer *buffer,prepare_t prepare )
+{
+    file_t file;
+    file._path    = path;
+    file._buffer  = buffer;
+    file._prepare = prepare;
+
+    _files.push_back( file );
+}
+
+int lsaver::start()
+{
+    if ( _running )
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    _finished = false;
+    _errno    = 0;
+
+    int err = pthread_create( &_thread,NULL,routine,this );
+    if ( 0 != err )
+    {
+        clear();
+
+        errno = err;
+        return -1;
+    }
+
+    _running = true;
+    return 0;
+}
+
+int lsaver::status( int &err )
+{
+    err = 0;
+    if ( !_running ) return ST_IDLE;
+
+    pthread_mutex_lock( &_mutex );
+    bool finished = _finished;
+    pthread_mutex_unlock( &_mutex );
+
+    if ( !finished ) return ST_RUNNING;
+
+    return wait( err );
+}
+
+int lsaver::wait( int &err )
+{
+    err = 0;
+    if ( !_running ) return ST_IDLE;
+
+    pthread_join( _thread,NULL );
+    _running = false;
+
+    clear();
+
+    err = _errno;
+    return 0 == err ? ST_DONE : ST_ERROR;
+}
+
+void lsaver::clear()
+{
+    for ( size_t i = 0;i < _files.size();i ++ )
+    {
+        delete _files[i]._buffer;
+    }
+
+    _files.clear();
+}
+
+void *lsaver::routine( void *arg )
+{
+    lsaver *saver = (lsaver *)arg;
+
+    int err = 0;
+    for ( size_t i = 0;0 == err && i < saver->_files.size();i ++ )
+    {
+        file_t &file = saver->_files[i];
+        if ( file._prepare ) file._prepare( file._buffer );
+
+        lbuffer *buffer = file._buffer;
+        if ( write_file( file._path.c_str(),buffer->data(),buffer->size() ) < 0 )
+        {
+            err = errno;
+        }
+    }
+
+    pthread_mutex_lock( &saver->_mutex );
+    saver->_errno    = err;
+    saver->_finished = true;
+    pthread_mutex_unlock( &saver->_mutex );
+
+    return NULL;
+}
+
+int lsaver::write_file( const char *path,const char *data,size_t sz )
+{
+    std::string tmp( path );
+    tmp += ".tmp";
+
+    int fd = ::open( tmp.c_str(),O_WRONLY | O_CREAT | O_TRUNC,0644 );
+    if ( fd < 0 ) return -1;
+
+    // 正常情况下只有一次write调用
+    while ( sz > 0 )
+    {
+        ssize_t n = ::write( fd,data,sz );
+        if ( n < 0 )
+        {
+            if ( EINTR == errno ) continue;
+            break;
+        }
+
+        data += n;
+        sz   -= n;
+    }
+
+    int err = 0;
+    if ( sz > 0 || ::fsync( fd ) < 0 ) err = errno;
+
+    if ( ::close( fd ) < 0 && 0 == err ) err = errno;
+
+    if ( 0 == err && ::rename( tmp.c_str(),path ) < 0 ) err = errno;
+
+    if ( 0 != err )
+    {
+        ::unlink( tmp.c_str() );
+
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
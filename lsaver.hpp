@@ -0,0 +1,69 @@
+#ifndef __LSAVER_H__
+#define __LSAVER_H__
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#include "lbuffer.hpp"
+
+/* 后台保存文件
+ * 主线程把数据序列化到lbuffer后交给工作线程，工作线程写入临时文件，
+ * fsync后rename为目标文件，保存过程中进程崩溃也不会破坏原文件
+ * 一个任务可以包含多个文件，按添加顺序写入，某个文件失败则不再写后面的文件
+ * 同一时间只有一个保存任务，主线程通过status轮询结果
+ */
+class lsaver
+{
+public:
+    typedef enum
+    {
+        ST_IDLE = 0, // 没有保存任务
+        ST_RUNNING , // 正在保存
+        ST_DONE    , // 保存完成，status返回一次后变为ST_IDLE
+        ST_ERROR     // 保存失败，同上
+    }status_t;
+
+    // 在工作线程中写入文件前调用，如计算校验值
+    typedef void (*prepare_t)( lbuffer *buffer );
+public:
+    ~lsaver();
+    explicit lsaver();
+
+    // 添加一个要保存的文件，buffer由lsaver负责释放。任务运行中(running)不能添加
+    void add( const char *path,lbuffer *buffer,prepare_t prepare = NULL );
+    // 开始保存已添加的文件。已有任务时返回-1
+    int start();
+    // 查询保存状态，ST_ERROR时err为errno
+    int status( int &err );
+    // 等待当前任务完成，返回值同status
+    int wait( int &err );
+
+    inline bool running() const { return _running; }
+
+    // 写入临时文件，fsync后rename为path
+    static int write_file( const char *path,const char *data,size_t sz );
+private:
+    static void *routine( void *arg );
+    void clear();
+
+    typedef struct
+    {
+        std::string _path;
+        lbuffer    *_buffer;
+        prepare_t   _prepare;
+    }file_t;
+
+    bool _running; // 是否有未回收的任务(线程未join)
+
+    pthread_t       _thread;
+    pthread_mutex_t _mutex;
+
+    // 以下由_mutex保护
+    bool _finished;
+    int  _errno;
+
+    std::vector<file_t> _files;
+};
+
+#endif /* __LSAVER_H__ */
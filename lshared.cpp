@@ -0,0 +1,224 @@
+#include "lshared.hpp"
+
+#include <cassert>
+#include <map>
+#include <time.h>
+
+/* 全局的共享排行，按名字索引 */
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::map< std::string,lshared * > registry;
+
+/* 单调时钟，毫秒 */
+static int64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC,&ts );
+
+    return (int64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+lshared *lshared::acquire( const char *name,const char *path,int backend )
+{
+    pthread_mutex_lock( &registry_mutex );
+
+    lshared *shared = NULL;
+    std::map< std::string,lshared * >::iterator itr = registry.find( name );
+    if ( itr != registry.end() )
+    {
+        shared = itr->second;
+    }
+    else
+    {
+        shared = new lshared( name,path,backend );
+        registry[name] = shared;
+    }
+    shared->_ref ++;
+
+    pthread_mutex_unlock( &registry_mutex );
+
+    return shared;
+}
+
+void lshared::release( lshared *shared )
+{
+    pthread_mutex_lock( &registry_mutex );
+
+    bool last = 0 == --shared->_ref;
+    if ( last ) registry.erase( shared->_name );
+
+    pthread_mutex_unlock( &registry_mutex );
+
+    if ( last ) delete shared;
+}
+
+lshared::~lshared()
+{
+    pthread_mutex_lock( &_vmutex );
+    _stop = true;
+    pthread_cond_signal( &_cond );
+    pthread_mutex_unlock( &_vmutex );
+
+    pthread_join( _thread,NULL );
+
+    unref( _view );
+    _view = NULL;
+
+    delete _lir;
+    _lir = NULL;
+
+    pthread_mutex_destroy( &_wmutex );
+    pthread_mutex_destroy( &_vmutex );
+    pthread_cond_destroy( &_cond );
+}
+
+lshared::lshared( const char *name,const char *path,int backend )
+    : _name( name )
+{
+    _ref      = 0;
+    _lir      = new lir( path,backend );
+    _view     = NULL;
+    _dirty    = false;
+    _stop     = false;
+    _interval = 0;
+    _publish  = 0;
+
+    pthread_mutex_init( &_wmutex,NULL );
+    pthread_mutex_init( &_vmutex,NULL );
+
+    // 等待的超时时间和now_ms一样用单调时钟
+    pthread_condattr_t attr;
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr,CLOCK_MONOTONIC );
+    pthread_cond_init( &_cond,&attr );
+    pthread_condattr_destroy( &attr );
+
+    build();
+
+    int err = pthread_create( &_thread,NULL,routine,this );
+    assert( 0 == err );
+    (void)err;
+}
+
+lir *lshared::lock()
+{
+    pthread_mutex_lock( &_wmutex );
+
+    return _lir;
+}
+
+void lshared::unlock( bool modify )
+{
+    if ( modify )
+    {
+        pthread_mutex_lock( &_vmutex );
+        if ( !_dirty ) pthread_cond_signal( &_cond );
+        _dirty = true;
+        pthread_mutex_unlock( &_vmutex );
+    }
+
+    pthread_mutex_unlock( &_wmutex );
+}
+
+lshared::view_t *lshared::get_view()
+{
+    pthread_mutex_lock( &_vmutex );
+    view_t *view = _view;
+    view->_ref ++;
+    pthread_mutex_unlock( &_vmutex );
+
+    return view;
+}
+
+void lshared::release_view( view_t *view )
+{
+    pthread_mutex_lock( &_vmutex );
+    unref( view );
+    pthread_mutex_unlock( &_vmutex );
+}
+
+void lshared::publish()
+{
+    pthread_mutex_lock( &_wmutex );
+    build();
+    pthread_mutex_unlock( &_wmutex );
+}
+
+void lshared::set_interval( int interval )
+{
+    pthread_mutex_lock( &_vmutex );
+    _interval = interval;
+    pthread_cond_signal( &_cond );
+    pthread_mutex_unlock( &_vmutex );
+}
+
+void *lshared::routine( void *arg )
+{
+    static_cast<lshared *>( arg )->run();
+
+    return NULL;
+}
+
+/* 持有_vmutex等待快照过期，生成快照时先释放_vmutex
+ * 加锁顺序是先_wmutex再_vmutex(同unlock)，持有_vmutex时不能去获取_wmutex
+ */
+void lshared::run()
+{
+    pthread_mutex_lock( &_vmutex );
+    while ( !_stop )
+    {
+        if ( !_dirty )
+        {
+            pthread_cond_wait( &_cond,&_vmutex );
+            continue;
+        }
+
+        int64_t deadline = _publish + _interval;
+        if ( deadline > now_ms() )
+        {
+            struct timespec ts;
+            ts.tv_sec  = deadline/1000;
+            ts.tv_nsec = ( deadline%1000 )*1000000;
+            pthread_cond_timedwait( &_cond,&_vmutex,&ts );
+            continue;
+        }
+        pthread_mutex_unlock( &_vmutex );
+
+        // publish可能已经生成了快照，获取写锁后再检查一次
+        pthread_mutex_lock( &_wmutex );
+        pthread_mutex_lock( &_vmutex );
+        bool dirty = _dirty;
+        pthread_mutex_unlock( &_vmutex );
+
+        if ( dirty ) build();
+        pthread_mutex_unlock( &_wmutex );
+
+        pthread_mutex_lock( &_vmutex );
+    }
+    pthread_mutex_unlock( &_vmutex );
+}
+
+/* 生成新快照并替换当前快照。持有写锁，生成过程中排行不会变化 */
+void lshared::build()
+{
+    lbuffer *buffer = new lbuffer();
+    _lir->snapshot( *buffer );
+
+    view_t *view = new view_t();
+    view->_ref = 1;
+
+    int err = view->_snapshot.open( buffer );
+    assert( 0 == err );
+    (void)err;
+
+    pthread_mutex_lock( &_vmutex );
+    unref( _view );
+    _view    = view;
+    _dirty   = false;
+    _publish = now_ms();
+    pthread_mutex_unlock( &_vmutex );
+}
+
+void lshared::unref( view_t *view )
+{
+    if ( view && 0 == --view->_ref ) delete view;
+}
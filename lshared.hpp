@@ -0,0 +1,71 @@
+#ifndef __LSHARED_H__
+#define __LSHARED_H__
+
+#include <string>
+#include <pthread.h>
+
+#include "lsnapshot.hpp"
+
+/* 多个lua_State(线程)共享的排行
+ * 写操作持有写锁串行执行。读操作只访问不可变的快照(同lsnapshot)，快照有
+ * 引用计数，读的过程中被替换也不会释放
+ * 排行变化后快照过期，由每个共享排行自己的发布线程重新生成快照，读操作只
+ * 是取当前快照的引用，不会因为写操作或者生成快照而阻塞
+ */
+class lshared
+{
+public:
+    typedef struct
+    {
+        lsnapshot _snapshot;
+        int       _ref;
+    }view_t;
+public:
+    // 按名字获取共享排行，不存在则用path、backend创建，引用计数加1
+    static lshared *acquire( const char *name,const char *path,int backend );
+    // 引用计数减1，为0时释放排行(不会自动保存)
+    static void release( lshared *shared );
+
+    // 获取写锁，返回排行对象，修改完成后调用unlock
+    lir *lock();
+    // 释放写锁，modify表示排行发生了变化，快照需要重新生成
+    void unlock( bool modify );
+
+    // 获取当前快照，引用计数加1，用完调用release_view
+    view_t *get_view();
+    void release_view( view_t *view );
+
+    // 立即重新生成快照，会等待写锁
+    void publish();
+    // 两次自动生成快照的最小间隔(毫秒)，0表示快照过期后马上生成
+    // 生成快照需要序列化整个排行(O(n))，期间阻塞写操作，写多时应该设置间隔
+    void set_interval( int interval );
+
+    inline const char *name() const { return _name.c_str(); }
+private:
+    ~lshared();
+    explicit lshared( const char *name,const char *path,int backend );
+
+    void build(); // 需要持有写锁
+    void unref( view_t *view ); // 需要持有_vmutex
+
+    // 发布线程，快照过期并且距上次生成超过_interval时重新生成
+    static void *routine( void *arg );
+    void run();
+
+    std::string _name;
+    int         _ref;      // 引用计数，由全局锁保护
+    lir        *_lir;
+
+    pthread_mutex_t _wmutex;   // 写锁
+    pthread_mutex_t _vmutex;   // 保护_view、_dirty、_publish、_interval、_stop
+    pthread_cond_t  _cond;     // 通知发布线程，配合_vmutex使用
+    pthread_t       _thread;   // 发布线程
+    view_t         *_view;     // 当前快照
+    bool            _dirty;    // 快照是否过期
+    bool            _stop;     // 发布线程是否需要退出
+    int             _interval; // 自动生成快照的最小间隔(毫秒)
+    int64_t         _publish;  // 上次生成快照的时间(毫秒)
+};
+
+#endif /* __LSHARED_H__ */
@@ -0,0 +1,200 @@
+#include "lsnapshot.hpp"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+lsnapshot::~lsnapshot()
+{
+    close();
+}
+
+lsnapshot::lsnapshot()
+{
+    _buffer = NULL;
+    _base   = NULL;
+    _length = 0;
+    _stride = 0;
+    _header = NULL;
+}
+
+int lsnapshot::open( const char *path )
+{
+    close();
+
+    int fd = ::open( path,O_RDONLY );
+    if ( fd < 0 ) return -1;
+
+    struct stat st;
+    if ( ::fstat( fd,&st ) < 0 )
+    {
+        int err = errno;
+        ::close( fd );
+        errno   = err;
+        return -1;
+    }
+
+    if ( (size_t)st.st_size < sizeof(header_t) )
+    {
+        ::close( fd );
+        return 19;
+    }
+
+    void *ptr = mmap( NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0 );
+    ::close( fd ); // 映射后不再需要fd
+    if ( MAP_FAILED == ptr ) return -1;
+
+    _base   = (const char *)ptr;
+    _length = st.st_size;
+
+    return check();
+}
+
+int lsnapshot::open( lbuffer *buffer )
+{
+    close();
+
+    _buffer = buffer;
+    _base   = buffer->data();
+    _length = buffer->size();
+    if ( _length < sizeof(header_t) )
+    {
+        close();
+        return 19;
+    }
+
+    return check();
+}
+
+/* 只校验文件头及各段的边界，数据在访问时才会读入内存 */
+int lsnapshot::check()
+{
+    const header_t *header = (const header_t *)_base;
+    uint64_t n = header->_size;
+    if ( MAGIC != header->_magic || VERSION != header->_version
+        || header->_factor > (uint32_t)lir::MAX_FACTOR
+        || header->_end != _length
+        || header->_rank  != sizeof(header_t)
+        || header->_index != header->_rank + n*( sizeof(lir::key_t) + sizeof(lir::factor_t)*header->_factor )
+        || header->_voff  != header->_index + n*sizeof(index_t)
+        || header->_value != header->_voff + ( n + 1 )*sizeof(uint64_t)
+        || header->_value > _length )
+    {
+        close();
+        return 19;
+    }
+
+    _header = header;
+    _stride = sizeof(lir::key_t) + sizeof(lir::factor_t)*header->_factor;
+
+    return 0;
+}
+
+void lsnapshot::close()
+{
+    if ( _buffer )
+    {
+        delete _buffer;
+    }
+    else if ( _base )
+    {
+        munmap( const_cast<char *>( _base ),_length );
+    }
+
+    _buffer = NULL;
+    _base   = NULL;
+    _length = 0;
+    _stride = 0;
+    _header = NULL;
+}
+
+const lir::key_t *lsnapshot::get_key( int index ) const
+{
+    if ( index < 0 || index >= size() ) return NULL;
+
+    return (const lir::key_t *)record( index );
+}
+
+int lsnapshot::get_position( lir::key_t key ) const
+{
+    if ( !_header ) return 0;
+
+    const index_t *index = (const index_t *)( _base + _header->_index );
+
+    int lo = 0;
+    int hi = size();
+    while ( lo < hi )
+    {
+        int mid = lo + ( hi - lo )/2;
+        if ( index[mid]._key < key )
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    if ( lo >= size() || index[lo]._key != key ) return 0;
+
+    // 快照没有校验值，损坏的排名不能用于访问排名数组
+    if ( index[lo]._pos < 1 || index[lo]._pos > size() ) return 0;
+
+    return (int)index[lo]._pos;
+}
+
+int lsnapshot::get_factor( lir::key_t key,const lir::factor_t **factor ) const
+{
+    int pos = get_position( key );
+    if ( pos <= 0 ) return 0;
+
+    *factor = factor_at( pos - 1 );
+
+    return factor_count();
+}
+
+int lsnapshot::get_value( lir::key_t key,lir::lval_t *val ) const
+{
+    int pos = get_position( key );
+    if ( pos <= 0 ) return 0;
+
+    return value_at( pos - 1,val );
+}
+
+const lir::factor_t *lsnapshot::factor_at( int index ) const
+{
+    if ( index < 0 || index >= size() ) return NULL;
+
+    return (const lir::factor_t *)( record( index ) + sizeof(lir::key_t) );
+}
+
+int lsnapshot::value_at( int index,lir::lval_t *val ) const
+{
+    if ( index < 0 || index >= size() ) return 0;
+
+    const uint64_t *voff = (const uint64_t *)( _base + _header->_voff );
+    uint64_t from = voff[index];
+    uint64_t to   = voff[index + 1];
+    if ( from > to || _header->_value + to > _length ) return 0;
+
+    lreader reader( _base + _header->_value + from,to - from );
+
+    uint64_t vcnt = 0;
+    if ( !reader.read_varint( vcnt ) ) return 0;
+
+    int vsz = 0;
+    for ( uint64_t i = 0;i < vcnt && i < (uint64_t)lir::MAX_VALUE;i ++ )
+    {
+        int index = 0;
+        lir::lval_t lval;
+        if ( lir::decode_value( reader,index,lval ) ) break;
+
+        while ( vsz <= index ) val[vsz++]._vt = lir::LVT_UNDEF;
+        val[index] = lval;
+    }
+
+    return vsz;
+}
@@ -0,0 +1,84 @@
+#ifndef __LSNAPSHOT_H__
+#define __LSNAPSHOT_H__
+
+#include "linsertion_ranking.hpp"
+
+/* 排行只读快照
+ * 由lir::save_snapshot生成，打开时直接mmap整个文件，不需要构建任何对象，
+ * 多个进程打开同一个快照时共享page cache。也可以直接使用内存中的快照数据
+ * (lir::snapshot)，见lshared
+ *
+ * 文件格式(所有数据按8字节对齐)：
+ * header_t
+ * 排名数组 : 按排名顺序，每个元素为key + _factor个排序因子
+ * key索引  : 按key排序的index_t，用于二分查找排名
+ * 变量偏移 : _size + 1个uint64_t，排名i的变量数据为[voff[i],voff[i + 1])
+ * 变量数据 : 同lir::serialize_value
+ */
+class lsnapshot
+{
+public:
+    const static uint32_t MAGIC   = 0x5352494C; // "LIRS"
+    const static uint32_t VERSION = 1;
+
+    typedef struct
+    {
+        uint32_t _magic;
+        uint32_t _version;
+        uint32_t _factor;  // 排序因子数量
+        uint32_t _size;    // 元素数量
+        uint64_t _rank;    // 排名数组偏移
+        uint64_t _index;   // key索引偏移
+        uint64_t _voff;    // 变量偏移数组的偏移
+        uint64_t _value;   // 变量数据偏移
+        uint64_t _end;     // 文件大小
+        uint64_t _reserve;
+    }header_t;
+
+    typedef struct
+    {
+        lir::key_t _key;
+        int64_t    _pos; // 排名，从1开始
+    }index_t;
+public:
+    ~lsnapshot();
+    explicit lsnapshot();
+
+    // 打开快照文件，返回错误码，-1为系统错误(见errno)
+    int open( const char *path );
+    // 使用内存中的快照数据，buffer由lsnapshot负责释放
+    int open( lbuffer *buffer );
+    void close();
+
+    inline int size() const { return _header ? (int)_header->_size : 0; }
+    inline int factor_count() const { return _header ? (int)_header->_factor : 0; }
+
+    // 根据排名获取key，index从0开始
+    const lir::key_t *get_key( int index ) const;
+    // 根据key获取排名，从1开始，不存在返回0
+    int get_position( lir::key_t key ) const;
+    // 获取排序因子，返回排序因子数量
+    int get_factor( lir::key_t key,const lir::factor_t **factor ) const;
+    // 获取变量，val的大小为lir::MAX_VALUE，返回最大下标 + 1。字符串指向快照内存
+    int get_value( lir::key_t key,lir::lval_t *val ) const;
+
+    // 根据排名获取排序因子，index从0开始，数量为factor_count()
+    const lir::factor_t *factor_at( int index ) const;
+    // 根据排名获取变量，index从0开始，同get_value
+    int value_at( int index,lir::lval_t *val ) const;
+private:
+    int check();
+    const char *record( int index ) const
+    {
+        return _base + _header->_rank + _stride*index;
+    }
+
+    lbuffer    *_buffer; // 内存中的快照，为NULL时_base为mmap的内存
+    const char *_base;
+    size_t      _length;
+    size_t      _stride; // 排名数组中每个元素的大小
+
+    const header_t *_header;
+};
+
+#endif /* __LSNAPSHOT_H__ */
@@ -0,0 +1,101 @@
+#include "lstat.hpp"
+
+#include <time.h>
+
+lhistogram::~lhistogram()
+{
+}
+
+lhistogram::lhistogram()
+{
+    _count = 0;
+    _min   = 0;
+    _max   = 0;
+    _sum   = 0;
+}
+
+/* 小于2*SUB_BUCKET的值每个值一个桶，之后每个2的幂区间SUB_BUCKET个桶 */
+int lhistogram::index( uint64_t val )
+{
+    if ( val < (uint64_t)SUB_BUCKET ) return (int)val;
+
+    int e = 63 - __builtin_clzll( val );
+    int sub = (int)( ( val >> ( e - SUB_BITS ) ) & ( SUB_BUCKET - 1 ) );
+
+    return ( e - SUB_BITS + 1 )*SUB_BUCKET + sub;
+}
+
+/* 桶的下限 */
+uint64_t lhistogram::lower( int index )
+{
+    if ( index < SUB_BUCKET ) return index;
+
+    int e   = index/SUB_BUCKET + SUB_BITS - 1;
+    int sub = index%SUB_BUCKET;
+
+    return (uint64_t)( SUB_BUCKET + sub ) << ( e - SUB_BITS );
+}
+
+void lhistogram::record( int64_t val )
+{
+    if ( val < 0 ) val = 0;
+    if ( _bucket.empty() ) _bucket.resize( BUCKET,0 );
+
+    _bucket[index( val )] ++;
+
+    if ( 0 == _count || val < _min ) _min = val;
+    if ( val > _max ) _max = val;
+
+    _count ++;
+    _sum += val;
+}
+
+void lhistogram::reset()
+{
+    _count = 0;
+    _min   = 0;
+    _max   = 0;
+    _sum   = 0;
+    _bucket.clear();
+}
+
+int64_t lhistogram::percentile( double p ) const
+{
+    if ( 0 == _count ) return 0;
+
+    int64_t rank = (int64_t)( p/100*_count + 0.5 );
+    if ( rank < 1 ) rank = 1;
+
+    int64_t sum = 0;
+    for ( int i = 0;i < BUCKET;i ++ )
+    {
+        sum += _bucket[i];
+        if ( sum < rank ) continue;
+
+        if ( i + 1 >= BUCKET ) return _max;
+
+        uint64_t upper = lower( i + 1 ) - 1;
+        return upper < (uint64_t)_max ? (int64_t)upper : _max;
+    }
+
+    return _max;
+}
+
+ltimer::~ltimer()
+{
+    if ( _histogram ) _histogram->record( now() - _begin );
+}
+
+ltimer::ltimer( lhistogram *histogram )
+{
+    _histogram = histogram;
+    _begin     = histogram ? now() : 0;
+}
+
+int64_t ltimer::now()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC,&ts );
+
+    return (int64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
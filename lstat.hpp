@@ -0,0 +1,55 @@
+#ifndef __LSTAT_H__
+#define __LSTAT_H__
+
+#include <vector>
+#include <stdint.h>
+
+/* 对数线性直方图(类似HdrHistogram)
+ * 每个2的幂区间[2^e,2^(e+1))平均分成SUB_BUCKET个桶，相对误差不超过1/16，
+ * 所有int64范围内的值只需要976个桶。桶在第一次记录时才分配
+ */
+class lhistogram
+{
+public:
+    ~lhistogram();
+    explicit lhistogram();
+
+    void record( int64_t val );
+    void reset();
+
+    inline int64_t count() const { return _count; }
+    inline int64_t min() const { return _count ? _min : 0; }
+    inline int64_t max() const { return _max; }
+    inline double mean() const { return _count ? (double)_sum/_count : 0; }
+
+    // 第p(0~100)百分位的值，返回所在桶的上限
+    int64_t percentile( double p ) const;
+private:
+    const static int SUB_BITS   = 4;
+    const static int SUB_BUCKET = 1 << SUB_BITS;
+    const static int BUCKET     = ( 64 - SUB_BITS + 1 )*SUB_BUCKET;
+
+    static int index( uint64_t val );
+    static uint64_t lower( int index );
+
+    int64_t _count;
+    int64_t _min;
+    int64_t _max;
+    int64_t _sum;
+    std::vector<int64_t> _bucket;
+};
+
+/* 计时，析构时把耗时(纳秒)记录到直方图，histogram为NULL时不计时 */
+class ltimer
+{
+public:
+    ~ltimer();
+    explicit ltimer( lhistogram *histogram );
+
+    static int64_t now(); // 单调时钟，纳秒
+private:
+    lhistogram *_histogram;
+    int64_t     _begin;
+};
+
+#endif /* __LSTAT_H__ */
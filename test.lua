@@ -104,6 +104,10 @@ for i = 1,math.floor(MAX_EMET/2) do
 
     lir:set_one_factor( key_id,factor,f_index )
 end
+local ok,msg = pcall( lir.set_one_factor,lir,1,1,0 )
+assert( not ok and msg:find( "index must be in" ) )
+ok,msg = pcall( lir.set_one_factor,lir,1,1,( 1 << 32 ) + 1 )
+assert( not ok and msg:find( "too many ranking factor" ) )
 
 for i = 1,math.floor(MAX_EMET/3) do
     local key_id  = math.random( 1,MAX_EMET )
@@ -111,6 +115,14 @@ for i = 1,math.floor(MAX_EMET/3) do
     lir:del( key_id )
 end
 
+lir:set_intern( true )
+for pos = 1,lir:size() do
+    local key_id = lir:get_key( pos )
+    lir:set_one_value( key_id,"guild name shared by many players",1 )
+    lir:set_one_value( key_id,"tag",2 )
+end
+assert( "guild name shared by many players" == lir:get_value( lir:get_key( 1 ),1 ) )
+
 lir:dump()
 lir:dump( "test.dmp" )
 
@@ -136,11 +148,497 @@ for i = 1,math.floor(MAX_EMET/3) do
     print( lir:get_position( key_id ) )
 end
 
+local page = {}
+local _,n = lir:range( 1,100,"kfv",page )
+assert( n == math.min( 100,lir:size() ) and #page.key == n )
+for pos = 1,n do
+    local key_id = lir:get_key( pos )
+    assert( page.key[pos] == key_id )
+    assert( page.factor[(pos - 1)*MAX_FCNT + 1] == lir:get_factor( key_id ) )
+    assert( page.value[pos][1] == lir:get_value( key_id,1 ) )
+end
+local _,n = lir:range( 1,10,"k",page )
+assert( n == math.min( 10,lir:size() ) and #page.key == n )
+local _,n = lir:range( 1,math.maxinteger )
+assert( n == lir:size() )
+local _,n = lir:range( 1 << 31,1 << 32 )
+assert( 0 == n )
+
+local mid_key = lir:get_key( math.floor( lir:size()/2 ) )
+local _,n,pos = lir:around( mid_key,5,5,"kf",page )
+assert( pos == lir:get_position( mid_key ) and n == 11 )
+assert( page.key[6] == mid_key and #page.key == 11 )
+local _,n,pos = lir:around( MAX_EMET*100,5,5 )
+assert( 0 == n and 0 == pos )
+local _,n,pos = lir:around( mid_key,0,0x7fffffff )
+assert( n == lir:size() - pos + 1 )
+local _,n = lir:around( mid_key,1 << 40,1 << 40 )
+assert( n == lir:size() )
+
 local llir = Lir( "test.lir" )
 
 print( "load from file",llir:load() )
 print( "is any modify",llir:modify() )
 llir:dump( "test.dmp" )
+assert( llir:size() == lir:size() )
+for pos = 1,lir:size() do
+    assert( llir:get_key( pos ) == lir:get_key( pos ) )
+end
+
+local tllir = Lir( "test.lir","tree" )
+assert( tllir:load() == lir:size() )
+for pos = 1,lir:size() do
+    assert( tllir:get_position( lir:get_key( pos ) ) == pos )
+end
+
+-- background save
+assert( true == lir:save_async( true ) )
+while "running" == lir:save_status() do end
+assert( "idle" == lir:save_status() )
+local alir = Lir( "test.lir" )
+assert( alir:load() == lir:size() )
+
+-- journal
+local jlir = Lir( "test_journal.lir" )
+jlir:set_journal( true )
+for i = 1,MAX_EMET do
+    jlir:set_factor( i,math.random( 1,100 ) )
+end
+jlir:save( true )
+for i = 1,10 do
+    jlir:set_factor( math.random( 1,MAX_EMET ),math.random( 1,100 ) )
+    jlir:set_one_value( i,"journal",1 )
+end
+jlir:del( MAX_EMET )
+assert( true == jlir:save() )
+local rlir = Lir( "test_journal.lir" )
+assert( rlir:load() == jlir:size() )
+for pos = 1,jlir:size() do
+    assert( rlir:get_key( pos ) == jlir:get_key( pos ) )
+end
+assert( "journal" == rlir:get_value( 1,1 ) )
+
+-- rejected updates must not be written to the journal
+assert( not pcall( rlir.set_one_value,rlir,1,"bad",0 ) )
+assert( 0 == rlir:del( MAX_EMET + 100 ) )
+rlir:set_journal( true )
+rlir:save( true )
+assert( not pcall( rlir.set_one_value,rlir,1,"bad",0 ) )
+assert( not pcall( rlir.set_one_value,rlir,MAX_EMET + 100,"bad",1 ) )
+assert( 0 == rlir:del( MAX_EMET + 100 ) )
+rlir:set_one_value( 2,"journal",1 )
+rlir:save()
+local blir = Lir( "test_journal.lir" )
+assert( blir:load() == rlir:size() and "journal" == blir:get_value( 2,1 ) )
+
+-- elements pushed out of a capped board are journaled as deleted
+local cj = Lir( "test_journal_capped.lir" )
+cj:set_journal( true )
+cj:set_max_size( 10 )
+for i = 1,10 do cj:set_factor( i,i ) end
+cj:save( true )
+for i = 11,15 do cj:set_factor( i,i ) end
+assert( 0 == cj:set_factor( 16,0 ) )
+cj:save()
+local rcj = Lir( "test_journal_capped.lir" )
+assert( 10 == rcj:load() )
+for pos = 1,10 do assert( rcj:get_key( pos ) == cj:get_key( pos ) ) end
+
+-- read-only snapshot
+lir:save_snapshot( "test.snp" )
+local snapshot = Lir.open_mapped( "test.snp" )
+assert( snapshot:size() == lir:size() )
+for pos = 1,lir:size() do
+    local key_id = lir:get_key( pos )
+    assert( snapshot:get_key( pos ) == key_id )
+    assert( snapshot:get_position( key_id ) == pos )
+    assert( snapshot:get_factor( key_id ) == lir:get_factor( key_id ) )
+    assert( snapshot:get_value( key_id,1 ) == lir:get_value( key_id,1 ) )
+end
+local spage,n = snapshot:range( 1,math.maxinteger,"kfv" )
+assert( n == lir:size() )
+local _,n = lir:range( 1,n,"kfv",page )
+for i = 1,n do
+    assert( spage.key[i] == page.key[i] and spage.value[i][1] == page.value[i][1] )
+end
+for i = 1,#page.factor do assert( spage.factor[i] == page.factor[i] ) end
+local _,n,pos = snapshot:around( mid_key,5,5,"k",spage )
+assert( pos == lir:get_position( mid_key ) and spage.key[pos - 5 >= 1 and 6 or pos] == mid_key )
+assert( not pcall( Lir.open_mapped,"test.lir" ) )
+
+-- shared board
+local sa = Lir.shared( "test_shared","test_shared.lir" )
+local sb = Lir.shared( "test_shared" )
+for i = 1,MAX_EMET do
+    sa:set_factor( i,math.random( 1,100 ) )
+end
+sa:set_one_value( 1,"shared",1 )
+sb:publish()
+assert( sb:size() == MAX_EMET and "shared" == sb:get_value( 1,1 ) )
+for pos = 1,sb:size() do
+    assert( sb:get_position( sb:get_key( pos ) ) == pos )
+end
+assert( not pcall( sb.get_key,sb,0 ) )
+local spage,n = sb:range( 1,10,"kv" )
+assert( 10 == n and sb:get_key( 10 ) == spage.key[10] )
+local _,n,pos = sb:around( 1,0,0,"v",spage )
+assert( 1 == n and pos == sb:get_position( 1 ) and "shared" == spage.value[1][1] )
+local new_pos = sa:set_factors_bulk( { { 1,1000 },{ MAX_EMET + 1,999 } } )
+assert( 1 == new_pos[1] and 2 == new_pos[2] )
+assert( not pcall( sa.set_factors_bulk,sa,{ { 1 } } ) )
+-- the snapshot is rebuilt in background without publish
+local deadline = os.clock() + 5
+while sb:size() == MAX_EMET and os.clock() < deadline do end
+assert( sb:size() == MAX_EMET + 1 and 1 == sb:get_position( 1 ) )
+
+-- corrupted file must be detected by checksum
+local fd = io.open( "test.lir","rb" )
+local content = fd:read( "a" )
+fd:close()
+fd = io.open( "test_corrupt.lir","wb" )
+fd:write( content:sub( 1,-2 ) .. string.char( ( content:byte( -1 ) + 1 ) % 256 ) )
+fd:close()
+local clir = Lir( "test_corrupt.lir" )
+assert( not pcall( clir.load,clir ) )
+
+-- tree backend must give the same ranking as array backend
+local tlir = Lir( "test_tree.lir","tree" )
+local alir = Lir( "test_array.lir" )
+for i = 1,MAX_EMET*10 do
+    local key_id = math.random( 1,MAX_EMET )
+    local op     = math.random( 1,10 )
+    if op <= 6 then
+        local f1,f2 = math.random( 1,100 ),math.random( 1,100 )
+        local tn,to = tlir:set_factor( key_id,f1,f2 )
+        local an,ao = alir:set_factor( key_id,f1,f2 )
+        assert( tn == an and to == ao )
+    elseif op <= 9 then
+        local factor = math.random( 1,100 )
+        local f_index = math.random( 1,2 )
+        local tn,to = tlir:set_one_factor( key_id,factor,f_index )
+        local an,ao = alir:set_one_factor( key_id,factor,f_index )
+        assert( tn == an and to == ao )
+    else
+        assert( tlir:del( key_id ) == alir:del( key_id ) )
+    end
+end
+assert( tlir:size() == alir:size() )
+for pos = 1,alir:size() do
+    local key_id = alir:get_key( pos )
+    assert( tlir:get_key( pos ) == key_id )
+    assert( tlir:get_position( key_id ) == pos )
+end
+
+-- bulk update gives the same ranking with either backend whether it merges or
+-- moves one by one,same as updating the keys in ascending order one by one
+local tbulk = Lir( "test_tree.lir","tree" )
+local abulk = Lir( "test_array.lir" )
+local sbulk = Lir( "test_array.lir" )
+for round = 1,20 do
+    local bulk,last = {},{}
+    for i = 1,( round % 2 == 0 and MAX_EMET or 4 ) do
+        local key_id,factor = math.random( 1,MAX_EMET ),math.random( 1,5 )
+        bulk[i] = { key_id,factor }
+        last[key_id] = factor
+    end
+    local tn,to = tbulk:set_factors_bulk( bulk )
+    local an,ao = abulk:set_factors_bulk( bulk )
+    local keys = {}
+    for key_id in pairs( last ) do keys[#keys + 1] = key_id end
+    table.sort( keys )
+    for _,key_id in pairs( keys ) do sbulk:set_factor( key_id,last[key_id] ) end
+    for i = 1,#bulk do
+        assert( tn[i] == an[i] and to[i] == ao[i] )
+        assert( an[i] == sbulk:get_position( bulk[i][1] ) )
+    end
+end
+for pos = 1,abulk:size() do
+    assert( tbulk:get_key( pos ) == abulk:get_key( pos ) )
+    assert( sbulk:get_key( pos ) == abulk:get_key( pos ) )
+end
+
+-- bulk update
+local updates = {}
+for i = 1,MAX_EMET do
+    local key_id = math.random( 1,MAX_EMET*2 )
+    updates[i] = { key_id,math.random( 1,100 ),math.random( 1,100 ) }
+end
+local new_pos,old_pos = alir:set_factors_bulk( updates )
+for i,update in pairs( updates ) do
+    assert( alir:get_position( update[1] ) == new_pos[i] )
+end
+for pos = 2,alir:size() do
+    local f1,f2 = alir:get_factor( alir:get_key( pos - 1 ) )
+    local b1,b2 = alir:get_factor( alir:get_key( pos ) )
+    assert( f1 > b1 or ( f1 == b1 and f2 >= b2 ) )
+end
+
+-- merged view of several ranks
+local realms = { Lir( "test_realm1.lir" ),Lir( "test_realm2.lir","tree" ) }
+for i = 1,MAX_EMET do
+    realms[i % 2 + 1]:set_factor( i,math.random( 1,100 ) )
+end
+local merge = Lir.merge( realms[1],realms[2] )
+local keys,shards = merge:top( MAX_EMET )
+assert( #keys == MAX_EMET and merge:size() == MAX_EMET )
+for pos = 1,MAX_EMET do
+    assert( merge:get_position( keys[pos] ) == pos )
+    local key,shard = merge:get_key( pos )
+    assert( key == keys[pos] and shard == shards[pos] )
+    assert( realms[shards[pos]]:get_position( keys[pos] ) > 0 )
+end
+for pos = 2,MAX_EMET do
+    local f1 = realms[shards[pos - 1]]:get_factor( keys[pos - 1] )
+    local f2 = realms[shards[pos]]:get_factor( keys[pos] )
+    assert( f1 >= f2 )
+end
+local dlir = Lir( "test_realm3.lir" )
+dlir:set_decay( 60 )
+assert( not pcall( Lir.merge,realms[1],dlir ) )
+local empty = Lir( "test_realm4.lir" )
+local dmerge = Lir.merge( realms[1],empty )
+empty:set_decay( 60 )
+assert( not pcall( dmerge.top,dmerge,1 ) )
+
+-- packed factor must give the same ranking as unpacked factor
+local plir = Lir( "test_packed.lir" )
+local ulir = Lir( "test_unpacked.lir" )
+plir:set_packed( 16,32,8 )
+for i = 1,MAX_EMET*10 do
+    local key_id = math.random( 1,MAX_EMET )
+    local f1,f2,f3 = math.random( 0,100 ),math.random( 0,65535 ),math.random( 0,3 )
+    local pn,po = plir:set_factor( key_id,f1,f2,f3 )
+    local un,uo = ulir:set_factor( key_id,f1,f2,f3 )
+    assert( pn == un and po == uo )
+end
+assert( not pcall( plir.set_factor,plir,1,65536 ) )
+
+-- changes since
+local tk = Lir( "test_track.lir" )
+tk:set_track( 1000 )
+for i = 1,100 do tk:set_factor( i,i ) end
+local seq = tk:get_seq()
+tk:set_factor( 50,1000 )
+tk:set_one_value( 10,"changed",1 )
+tk:del( 1 )
+local t = tk:changes_since( seq )
+assert( not t.full and t.seq == tk:get_seq() )
+assert( 2 == #t.keys and 1 == #t.deleted and 1 == t.deleted[1] )
+assert( 1 == t.from and 99 == t.to )
+assert( tk:changes_since( tk:get_seq() ).from == nil )
+
+-- rank events
+local ev = Lir( "test_event.lir" )
+ev:set_watch( 100,1,10 )
+for i = 1,20 do ev:set_factor( i,i ) end
+ev:get_events()
+ev:set_factor( 5,100 )
+local events,dropped = ev:get_events()
+assert( 0 == dropped )
+local enter,leave = {},{}
+for _,e in pairs( events ) do
+    if "enter" == e.type then enter[e.rank] = e.key end
+    if "leave" == e.type then leave[e.rank] = e.key end
+end
+assert( 5 == enter[1] and 5 == enter[10] )
+assert( 20 == leave[1] and 11 == leave[10] )
+
+-- several elements cross the same threshold in one bulk update
+local evb = Lir( "test_event_bulk.lir" )
+evb:set_watch( 100,1 )
+evb:set_factor( 100,5 )
+evb:get_events()
+evb:set_factors_bulk( { { 1,10 },{ 2,9 } } )
+local top1 = { [100] = true }
+for _,e in pairs( evb:get_events() ) do
+    if 1 == e.rank and "enter" == e.type then top1[e.key] = true end
+    if 1 == e.rank and "leave" == e.type then top1[e.key] = nil end
+end
+assert( top1[1] and not top1[2] and not top1[100] )
+
+-- events of a bulk update move the watched top ranks from before to after it
+for _,backend in pairs( { "array","tree" } ) do
+    local evr = Lir( "test_event_bulk.lir",backend )
+    evr:set_watch( 100000,1,10,50 )
+    for i = 1,MAX_EMET do evr:set_factor( i,math.random( 1,50 ) ) end
+    local tops = {}
+    for _,rank in pairs( { 1,10,50 } ) do
+        tops[rank] = {}
+        for pos = 1,rank do tops[rank][evr:get_key( pos )] = true end
+    end
+    evr:get_events()
+    local bulk = {}
+    for i = 1,MAX_EMET/4 do
+        bulk[i] = { math.random( 1,MAX_EMET*2 ),math.random( 1,50 ) }
+    end
+    evr:set_factors_bulk( bulk )
+    for _,e in pairs( evr:get_events() ) do
+        if "enter" == e.type then tops[e.rank][e.key] = true end
+        if "leave" == e.type then tops[e.rank][e.key] = nil end
+    end
+    for rank,top in pairs( tops ) do
+        local cnt = 0
+        for key in pairs( top ) do
+            cnt = cnt + 1
+            assert( evr:get_position( key ) <= rank )
+        end
+        assert( rank == cnt )
+    end
+end
+
+-- rollover empties the board,watchers get leave events for the old top ranks
+for _,backend in pairs( { "array","tree" } ) do
+    local evo = Lir( "test_event_rollover.lir",backend )
+    evo:set_watch( 100,1,10 )
+    for i = 1,20 do evo:set_factor( i,i ) end
+    evo:get_events()
+    evo:rollover()
+    local left = { [1] = {},[10] = {} }
+    local cnt = 0
+    for _,e in pairs( evo:get_events() ) do
+        assert( "leave" == e.type and 0 == e.to )
+        assert( e.from <= e.rank and 21 - e.from == e.key )
+        left[e.rank][e.key] = true
+        cnt = cnt + 1
+    end
+    assert( 11 == cnt and left[1][20] )
+    for key = 11,20 do assert( left[10][key] ) end
+end
+
+-- a journaled bulk update replays the same way whatever the board settings
+local jb = Lir( "test_journal_bulk.lir" )
+jb:set_journal( true )
+for i = 1,MAX_EMET do jb:set_factor( i,i % 10 ) end
+jb:save( true )
+local bulk = {}
+for i = 1,MAX_EMET do
+    bulk[i] = { math.random( 1,MAX_EMET*2 ),math.random( 0,9 ) }
+end
+jb:set_factors_bulk( bulk )
+assert( true == jb:save() )
+for _,setting in pairs( { "none","watch","max_size","tree" } ) do
+    local rb = Lir( "test_journal_bulk.lir","tree" == setting and "tree" or "array" )
+    if "watch" == setting then rb:set_watch( 100,1,10 ) end
+    if "max_size" == setting then rb:set_max_size( jb:size() ) end
+    assert( rb:load() == jb:size() )
+    for pos = 1,jb:size() do
+        assert( rb:get_key( pos ) == jb:get_key( pos ) )
+    end
+end
+
+-- runtime statistics
+local st = Lir( "test_stats.lir" )
+st:set_stats( true )
+for i = 1,MAX_EMET do st:set_factor( i,i ) end
+st:del( MAX_EMET )
+local t = st:stats( true )
+assert( MAX_EMET == t.update.count and 1 == t.del.count )
+assert( t.lookup == MAX_EMET + 1 and t.moved.max >= MAX_EMET - 2 )
+assert( t.update.p50 <= t.update.p99 and t.update.p99 <= t.update.max )
+assert( 0 == st:stats().update.count )
+
+-- queries by factor value
+for _,backend in pairs( { "array","tree" } ) do
+    local sc = Lir( "test_score.lir",backend )
+    for i = 1,MAX_EMET do sc:set_factor( i,i % 10,i ) end
+    local ge = 0
+    for i = 1,MAX_EMET do
+        if i % 10 > 5 or ( 5 == i % 10 and i >= 15 ) then ge = ge + 1 end
+    end
+    assert( ge == sc:count_ge( 5,15 ) )
+    assert( ge + 1 == sc:rank_of_score( 5,14.5 ) )
+    assert( MAX_EMET // 10 == sc:count_ge( 9 ) and 1 == sc:rank_of_score( 9,MAX_EMET + 1 ) )
+    local t,n,pos = sc:range_by_score( 3,4,0,"kf" )
+    assert( n == MAX_EMET // 10 * 2 and pos == sc:get_position( t.key[1] ) )
+    for i = 1,n do
+        local f = t.factor[( i - 1 )*2 + 1]
+        assert( f >= 3 and f <= 4 )
+    end
+    t,n = sc:range_by_score( 3,4,5 )
+    assert( 5 == n and 4 == sc:get_factor( t.key[1] ) )
+    t,n = sc:range_by_score( 3,4,( 1 << 32 ) + 5 )
+    assert( n == MAX_EMET // 10 * 2 )
+    t,n,pos = sc:range_by_score( 20,30 )
+    assert( 0 == n and 0 == pos )
+end
+
+-- decaying factor
+for _,backend in pairs( { "array","tree" } ) do
+    local hot = Lir( "test_decay.lir",backend )
+    hot:set_time( 1000 )
+    hot:set_decay( 60 )
+    assert( not pcall( hot.set_packed,hot,16 ) )
+    hot:set_factor( 1,100 )
+    hot:set_factor( 2,80 )
+    hot:set_time( 1060 )
+    assert( math.abs( hot:get_factor( 1 ) - 50 ) < 1e-9 )
+    hot:set_factor( 3,60 )
+    assert( 1 == hot:get_position( 3 ) and 2 == hot:get_position( 1 ) )
+    hot:set_time( 1060 + 60*100 )
+    hot:set_factor( 4,1 )
+    assert( 1 == hot:get_position( 4 ) and 2 == hot:get_position( 3 ) )
+    hot:save( true )
+
+    local reload = Lir( "test_decay.lir",backend )
+    reload:set_time( 1060 + 60*101 )
+    reload:set_decay( 60 )
+    reload:load()
+    assert( math.abs( reload:get_factor( 4 ) - 0.5 ) < 1e-9 )
+end
+
+-- queries never rebase,a rebase that reorders elements is reported
+local rb = Lir( "test_decay_rebase.lir" )
+rb:set_time( 1000 )
+rb:set_decay( 1 )
+rb:set_track( 100 )
+rb:set_watch( 100,1 )
+rb:set_factor( 1,2e-310,1 )
+rb:set_factor( 2,1e-310,2 )
+rb:save( true )
+rb:get_events()
+local seq = rb:get_seq()
+rb:set_time( 1100 )
+rb:count_ge( 0 )
+rb:rank_of_score( 0 )
+rb:range_by_score( 0,1 )
+assert( seq == rb:get_seq() and not rb:modify() and 1 == rb:get_key( 1 ) )
+rb:set_factor( 3,1 )
+assert( 3 == rb:get_key( 1 ) and 2 == rb:get_key( 2 ) and 1 == rb:get_key( 3 ) )
+local t = rb:changes_since( seq )
+assert( 3 == #t.keys )
+local enter = {}
+for _,e in pairs( rb:get_events() ) do
+    if "enter" == e.type then enter[e.key] = true end
+end
+assert( enter[2] and enter[3] )
+
+-- rollover to a new period
+for _,backend in pairs( { "array","tree" } ) do
+    local season = Lir( "test_season.lir",backend )
+    for i = 1,MAX_EMET do season:set_factor( i,i ) end
+    season:set_one_value( 1,"season",1 )
+    local last = season:rollover( "test_season.snp" )
+    assert( 0 == season:size() and 0 == season:get_position( 1 ) )
+    assert( MAX_EMET == last:size() and MAX_EMET == last:get_key( 1 ) )
+    assert( "season" == last:get_value( 1,1 ) )
+    assert( MAX_EMET == Lir.open_mapped( "test_season.snp" ):size() )
+    season:set_factor( 1,1 )
+    assert( 1 == season:size() and MAX_EMET == last:size() )
+end
+
+-- capped board keep only the top N
+for _,backend in pairs( { "array","tree" } ) do
+    local clir = Lir( "test_capped.lir",backend )
+    clir:set_max_size( 10 )
+    for i = 1,MAX_EMET do
+        clir:set_factor( i,i )
+    end
+    assert( 10 == clir:size() and MAX_EMET == clir:get_key( 1 ) )
+    assert( 0 == clir:set_factor( MAX_EMET + 1,1 ) )
+    assert( 0 == clir:get_position( MAX_EMET + 1 ) )
+    clir:set_max_size( 5 )
+    assert( 5 == clir:size() and MAX_EMET - 4 == clir:get_key( 5 ) )
+end
 
 local MAX_TS = 100000
 local lb = Lir( "benchmark.lir" )